@@ -21,12 +21,22 @@
 
 #include <vpk/version.h>
 #include <vpk/package.h>
+#include <vpk/path_index.h>
+#include <vpk/index_cache.h>
 #include <vpk/node.h>
 #include <vpk/dir.h>
 #include <vpk/file.h>
+#include <vpk/tree_iterator.h>
+#include <vpk/visitor.h>
 #include <vpk/handler.h>
+#include <vpk/stats_handler.h>
+#include <vpk/profile.h>
+#include <vpk/extraction_plan.h>
+#include <vpk/async_reader.h>
+#include <vpk/archive_set.h>
 #include <vpk/data_handler.h>
 #include <vpk/data_handler_factory.h>
+#include <vpk/crc32.h>
 #include <vpk/checking_data_handler.h>
 #include <vpk/checking_data_handler_factory.h>
 #include <vpk/file_data_handler.h>
@@ -0,0 +1,96 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_ARCHIVE_SET_H
+#define VPK_ARCHIVE_SET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include <map>
+#include <exception>
+
+#include <boost/shared_ptr.hpp>
+
+#include <vpk/mmap.h>
+
+namespace Vpk {
+	class File;
+	class Package;
+	class ExtractionPlan;
+
+	// The archives of a package, each mapped read-only once. Consumers get
+	// the data of a file as a span into the mapping instead of reading it
+	// into a buffer of their own.
+	//
+	// map() is not thread safe. Once all needed archives are mapped the
+	// set is read only and can be shared by any number of threads.
+	class ArchiveSet {
+	public:
+		struct Span {
+			Span() : data(0), size(0) {}
+			Span(const char *data, size_t size) : data(data), size(size) {}
+
+			const char *data;
+			size_t      size;
+		};
+
+		// advice is passed to madvise(2) for every mapped archive
+		ArchiveSet(const Package &package, int advice = MADV_SEQUENTIAL) :
+			m_package(package), m_advice(advice) {}
+
+		// Maps the archive if it isn't already. Errors are remembered and
+		// thrown again by span() of that archive.
+		void map(uint16_t index);
+
+		// maps every archive the plan reads from
+		void map(const ExtractionPlan &plan);
+
+		bool mapped(uint16_t index) const { return m_archives.find(index) != m_archives.end(); }
+
+		// The mapping of the archive or 0 when it isn't mapped (or couldn't
+		// be mapped).
+		const MMap *archive(uint16_t index) const;
+
+		// The archived part of the file (not the preload data) or the given
+		// range of an archive. Throws the error of the archive or
+		// Vpk::IOError(EOF) when the range is beyond its end.
+		Span span(const File *file) const;
+		Span span(uint16_t index, size_t offset, size_t size) const;
+
+		// asks the kernel to read the range ahead
+		void willneed(uint16_t index, size_t offset, size_t size) const;
+
+		void clear() { m_archives.clear(); }
+
+	private:
+		struct Archive {
+			boost::shared_ptr<MMap> map;
+			std::exception_ptr      error;
+		};
+
+		typedef std::map<uint16_t, Archive> Archives;
+
+		const Package &m_package;
+		int            m_advice;
+		Archives       m_archives;
+	};
+}
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_ASYNC_READER_H
+#define VPK_ASYNC_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <vector>
+
+namespace Vpk {
+	// Reads file ranges asynchronously, so many reads can be in flight at
+	// once. With io_uring all queued reads are handed to the kernel with a
+	// single syscall. Where io_uring can't be used (not built with it, old
+	// kernels, seccomp filters) the reads are done with pread() when their
+	// completion is waited for, which is what libvpk did before anyway.
+	//
+	// Not thread safe, use one reader per thread.
+	class AsyncReader {
+	public:
+		enum Backend {
+			IO_URING,
+			PREAD
+		};
+
+		enum { DEFAULT_DEPTH = 8 };
+
+		struct Completion {
+			uint64_t tag;
+			int      error; // 0, an errno value or EOF if the file is too short
+		};
+
+		// IO_URING silently falls back to PREAD, see backend()
+		AsyncReader(unsigned int depth = DEFAULT_DEPTH, Backend backend = IO_URING);
+		~AsyncReader();
+
+		// the backend that is actually used
+		Backend backend() const { return m_ring ? IO_URING : PREAD; }
+		unsigned int depth() const { return m_depth; }
+
+		// reads queued or in flight whose completion wasn't returned yet
+		size_t pending() const { return m_pending; }
+		bool   full() const { return m_free.empty(); }
+
+		// Queues a read of exactly size bytes. The buffer has to stay valid
+		// until wait() returned its completion. Must not be called when full().
+		void read(int fd, char *buf, size_t size, off_t offset, uint64_t tag);
+
+		// Submits all queued reads and blocks until one of them is done.
+		// Returns false if there are no pending reads.
+		bool wait(Completion &completion);
+
+		static const char *name(Backend backend);
+		static bool parse(const char *name, Backend &backend);
+
+		// whether io_uring can be used by this build on this system
+		static bool available();
+
+	private:
+		AsyncReader(const AsyncReader&);
+		AsyncReader &operator = (const AsyncReader&);
+
+		struct Request {
+			int      fd;
+			char    *buf;
+			size_t   size; // still to read
+			off_t    offset;
+			uint64_t tag;
+		};
+
+		struct Ring;
+
+		size_t acquire();
+		void   release(size_t slot) { m_free.push_back(slot); }
+		void   readNow(size_t slot);
+		void   push(size_t slot);
+		void   reap();
+		void   complete(size_t slot, int error);
+
+		unsigned int           m_depth;
+		std::vector<Request>   m_requests;
+		std::vector<size_t>    m_free;
+		std::deque<size_t>     m_queued; // PREAD only, in order
+		std::deque<Completion> m_done;
+		size_t                 m_pending;
+		Ring                  *m_ring;
+	};
+}
+
+#endif
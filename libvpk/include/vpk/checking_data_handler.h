@@ -19,7 +19,8 @@
 #ifndef VPK_CHECKING_DATA_HANDLER_H
 #define VPK_CHECKING_DATA_HANDLER_H
 
-#include <boost/crc.hpp>
+#include <vpk/crc32.h>
+#include <vpk/profile.h>
 
 #include <vpk/data_handler.h>
 
@@ -30,13 +31,14 @@ namespace Vpk {
 			DataHandler(path, crc32) {}
 
 		void process(const char *buffer, size_t length) {
+			Profiler::Timer timer(Profile::CHECK);
 			m_hash.process_bytes(buffer, length);
 		}
 
 		void finish();
 	
 	private:
-		boost::crc_32_type m_hash;
+		Crc32 m_hash;
 	};
 }
 
@@ -0,0 +1,206 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_COMPACT_TREE_H
+#define VPK_COMPACT_TREE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include <vpk/string_pool.h>
+#include <vpk/mem_reader.h>
+#include <vpk/mmap.h>
+
+namespace Vpk {
+	// Alternative in-memory representation of a package index for huge
+	// archives. Instead of one heap allocated Node per entry there are two
+	// flat record arrays, one string pool for all names and one blob holding
+	// all preload data.
+	//
+	// Dirs are numbered breadth first with the root as 0, so the subdirs of
+	// a dir are contiguous and sorted by name. The files of a dir are
+	// contiguous and sorted by name as well, which allows binary search
+	// lookups without any per-dir hash map.
+	//
+	// DirRef and FileRef are lightweight views mirroring the Dir and File API.
+	// The Dir and File nodes that unvpk and vpkfs use are in turn built on
+	// top of a tree kept by a LazyIndex: Package::read() with an IndexCache
+	// creates only the dirs and a dir creates its files from the records
+	// when it is accessed, so untouched dirs cost nothing but their records.
+	//
+	// The records don't contain pointers, so a tree can be saved to an
+	// IndexCache file and mapped again without rebuilding anything. The
+	// names, preload data and dir of a file are checked against the tables
+	// when they are accessed. A damaged file record of a mapped tree yields
+	// wrong data, but nothing outside the mapping is read. Dir records are
+	// checked by IndexCache when it maps a tree.
+	class CompactTree {
+	public:
+		typedef uint32_t Id;
+
+		static const Id NONE = 0xffffffff;
+
+		struct DirEntry {
+			Id       name;
+			Id       parent;
+			Id       firstDir;
+			uint32_t dirCount;
+			Id       firstFile;
+			uint32_t fileCount;
+		};
+
+		struct FileEntry {
+			Id       name;
+			Id       dir;
+			uint32_t crc32;
+			uint32_t size;
+			uint32_t offset;
+			uint32_t preload;
+			uint16_t preloadSize;
+			uint16_t index;
+			uint32_t preloadOffset; // in the _dir.vpk file
+		};
+
+		class DirRef;
+
+		class FileRef {
+		public:
+			FileRef(const CompactTree &tree, Id id) : m_tree(&tree), m_id(id) {}
+
+			Id id() const { return m_id; }
+			const FileEntry &entry() const { return m_tree->m_fileTable[m_id]; }
+
+			const char *name()        const { return m_tree->str(entry().name); }
+			uint32_t    crc32()       const { return entry().crc32; }
+			uint32_t    size()        const { return entry().size; }
+			uint32_t    offset()      const { return entry().offset; }
+			uint16_t    index()       const { return entry().index; }
+			const char *preload()     const { return m_tree->preload(entry()); }
+			size_t      preloadSize() const { return preload() ? entry().preloadSize : 0; }
+			uint32_t    preloadOffset() const { return entry().preloadOffset; }
+			DirRef      dir()         const;
+
+		private:
+			const CompactTree *m_tree;
+			Id                 m_id;
+		};
+
+		class DirRef {
+		public:
+			DirRef(const CompactTree &tree, Id id) : m_tree(&tree), m_id(id) {}
+
+			Id id() const { return m_id; }
+			const DirEntry &entry() const { return m_tree->m_dirTable[m_id]; }
+
+			const char *name()     const { return m_tree->str(entry().name); }
+			bool        isroot()   const { return m_id == 0; }
+			DirRef      parent()   const { return DirRef(*m_tree, entry().parent); }
+			size_t      subdirs()  const { return entry().dirCount; }
+			size_t      files()    const { return entry().fileCount; }
+			bool        empty()    const { return subdirs() == 0 && files() == 0; }
+			DirRef      subdir(size_t i) const { return DirRef(*m_tree, entry().firstDir + i); }
+			FileRef     file(size_t i)   const { return FileRef(*m_tree, entry().firstFile + i); }
+
+		private:
+			const CompactTree *m_tree;
+			Id                 m_id;
+		};
+
+		CompactTree() : m_version(0), m_dataOffset(0), m_footerOffset(0), m_footerSize(0) { attach(); }
+
+		void read(const boost::filesystem::path &path);
+		void read(MemReader &io);
+		void clear();
+
+		DirRef  root()        const { return DirRef(*this, 0); }
+		DirRef  dir(Id id)    const { return DirRef(*this, id); }
+		FileRef file(Id id)   const { return FileRef(*this, id); }
+		size_t  dircount()    const { return m_dirCount; }
+		size_t  filecount()   const { return m_fileCount; }
+		unsigned int version() const { return m_version; }
+		unsigned int dataoff() const { return m_dataOffset; }
+		unsigned int footerOffset() const { return m_footerOffset; }
+		unsigned int footerSize()   const { return m_footerSize; }
+
+		// true if the records are mapped from an index cache file
+		bool mapped() const { return m_map.opened(); }
+		size_t mappedSize() const { return m_map.size(); }
+
+		const char *str(Id id) const { return id < m_stringSize ? m_stringTable + id : m_stringTable; }
+		const char *preload(const FileEntry &file) const {
+			return file.preloadSize && file.preload <= m_preloadSize &&
+				file.preloadSize <= m_preloadSize - file.preload ? m_preloadTable + file.preload : 0;
+		}
+
+		// direct child lookups, return NONE if there is no such entry
+		Id findDir(Id parent, const char *name, size_t length) const;
+		Id findFile(Id dir, const char *name, size_t length) const;
+
+		// resolve a slash separated path, returns false if it doesn't exist
+		bool get(const char *path, Id &id, bool &isdir) const;
+
+		std::string path(const DirRef &dir) const;
+		std::string path(const FileRef &file) const;
+
+		// heap bytes used by the records, the string pool and the preload
+		// blob, a mapped tree uses none
+		size_t recordsMemoryUsage() const;
+		size_t stringsMemoryUsage() const { return m_strings.memoryUsage(); }
+		size_t preloadMemoryUsage() const { return m_preload.capacity(); }
+		size_t memoryUsage() const {
+			return recordsMemoryUsage() + stringsMemoryUsage() + preloadMemoryUsage();
+		}
+
+	private:
+		friend class IndexCache;
+		class Builder;
+
+		// points the tables at the owned vectors
+		void attach();
+
+		std::vector<DirEntry>  m_dirs;
+		std::vector<FileEntry> m_files;
+		StringPool             m_strings;
+		std::vector<char>      m_preload;
+		MMap                   m_map;
+
+		const DirEntry        *m_dirTable;
+		const FileEntry       *m_fileTable;
+		const char            *m_stringTable;
+		const char            *m_preloadTable;
+		size_t                 m_dirCount;
+		size_t                 m_fileCount;
+		size_t                 m_stringSize;
+		size_t                 m_preloadSize;
+
+		unsigned int           m_version;
+		unsigned int           m_dataOffset;
+		unsigned int           m_footerOffset;
+		unsigned int           m_footerSize;
+	};
+
+	inline CompactTree::DirRef CompactTree::FileRef::dir() const {
+		return DirRef(*m_tree, entry().dir < m_tree->m_dirCount ? entry().dir : 0);
+	}
+}
+
+#endif
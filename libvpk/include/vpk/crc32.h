@@ -0,0 +1,64 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_CRC32_H
+#define VPK_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Vpk {
+	// CRC-32 as used by VPK (same as zlib and boost::crc_32_type).
+	//
+	// The kernel is picked once at runtime: carry-less multiplication
+	// folding (PCLMULQDQ) on x86-64 CPUs that support it, slice-by-8
+	// table lookups everywhere else.
+	class Crc32 {
+	public:
+		// updates a raw (not inverted) CRC register
+		typedef uint32_t (*Kernel)(uint32_t crc, const char *buffer, size_t length);
+
+		Crc32() : m_crc(0xFFFFFFFF) {}
+
+		void process_bytes(const char *buffer, size_t length) {
+			m_crc = s_kernel(m_crc, buffer, length);
+		}
+
+		uint32_t checksum() const { return ~m_crc; }
+		void reset() { m_crc = 0xFFFFFFFF; }
+
+		static uint32_t compute(const char *buffer, size_t length) {
+			return ~s_kernel(0xFFFFFFFF, buffer, length);
+		}
+
+		static uint32_t updateSlice8(uint32_t crc, const char *buffer, size_t length);
+		// falls back to updateSlice8 if PCLMULQDQ isn't available
+		static uint32_t updatePclmul(uint32_t crc, const char *buffer, size_t length);
+
+		static bool hasPclmul();
+		static Kernel kernel() { return s_kernel; }
+		static const char *kernelName();
+
+	private:
+		static const Kernel s_kernel;
+
+		uint32_t m_crc;
+	};
+}
+
+#endif
@@ -20,6 +20,7 @@
 #define VPK_DATA_HANDLER_H
 
 #include <stdint.h>
+#include <sys/types.h>
 
 #include <string>
 
@@ -33,6 +34,16 @@ namespace Vpk {
 
 		virtual void process(const char *buffer, size_t length) = 0;
 		virtual void finish() = 0;
+
+		// Takes length bytes at offset of fd without having them read into
+		// memory first. Returns how many bytes it took, the rest is passed
+		// to process() by the caller. See DataHandlerFactory::zeroCopy().
+		virtual size_t copy(int fd, off_t offset, size_t length) {
+			(void) fd;
+			(void) offset;
+			(void) length;
+			return 0;
+		}
 	
 		const std::string &path()  const { return m_path; }
 		      uint32_t     crc32() const { return m_crc32; }
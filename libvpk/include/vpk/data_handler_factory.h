@@ -37,6 +37,15 @@ namespace Vpk {
 		}
 
 		virtual DataHandler *create(const std::string &path, uint32_t crc32) = 0;
+
+		// Called once for every directory before any file in it is created.
+		// Factories that write files can create the directory here.
+		virtual void mkdir(const std::string &path) { (void) path; }
+
+		// Whether the created handlers take their data with
+		// DataHandler::copy(). Package::process() doesn't read the archive
+		// data for them then.
+		virtual bool zeroCopy() const { return false; }
 	};
 }
 
@@ -21,9 +21,12 @@
 
 #include <string>
 #include <vector>
+#include <atomic>
 
 #include <vpk/node.h>
 #include <vpk/file_io.h>
+#include <vpk/mem_reader.h>
+#include <vpk/lazy_index.h>
 
 namespace Vpk {
 	class File;
@@ -33,30 +36,51 @@ namespace Vpk {
 		typedef Nodes::iterator iterator;
 		typedef Nodes::const_iterator const_iterator;
 
-		Dir(const std::string &name) : Node(name), m_subdirs(0) {}
+		Dir(const std::string &name) : Node(name), m_subdirs(0), m_treeDir(CompactTree::NONE), m_loaded(true) {}
 
 		Type type() const { return Node::DIR; }
 		void read(FileIO &io, const std::string &path, const std::string &type, std::vector<File*> &dirfiles);
+		void read(MemReader &io, const std::string &path, const std::string &type, std::vector<File*> &dirfiles);
 
-		const Nodes &nodes() const { return m_nodes; }
+		// Skips a file list and only remembers where it is. It is decoded
+		// when the files of this dir are accessed for the first time.
+		void defer(MemReader &io, const LazyIndexPtr &index, uint32_t pathOffset, uint32_t typeOffset);
+
+		// Defers the files of the dir with this id in index->tree.
+		void defer(const LazyIndexPtr &index, CompactTree::Id dir);
+		bool loaded() const { return m_loaded.load(std::memory_order_acquire); }
+
+		// Like node(), but doesn't decode deferred files. Used while the
+		// index is scanned, when only subdirs need to be found.
+		Node *scanned(const std::string &name);
+
+		const Nodes &nodes() const { load(); return m_nodes; }
 		const Node *node(const std::string &name) const;
 		      Node *node(const std::string &name);
 		void add(Node *node);
 		void remove(const std::string &name);
 
-		iterator begin() { return m_nodes.begin(); }
-		iterator end()   { return m_nodes.end(); }
-		const_iterator begin() const { return m_nodes.begin(); }
-		const_iterator end()   const { return m_nodes.end(); }
-		bool empty() const { return m_nodes.empty(); }
+		iterator begin() { load(); return m_nodes.begin(); }
+		iterator end()   { load(); return m_nodes.end(); }
+		const_iterator begin() const { load(); return m_nodes.begin(); }
+		const_iterator end()   const { load(); return m_nodes.end(); }
+		bool empty() const { load(); return m_nodes.empty(); }
 	
 		// only used by vpkfs so it can give a UNIX-like
 		// hardlink count so find works:
 		size_t subdirs() const { return m_subdirs; }
 
 	private:
-		Nodes  m_nodes;
-		size_t m_subdirs;
+		void load() const { if (!loaded()) decode(); }
+		void decode() const;
+
+		// decoding files doesn't change what the dir logically contains
+		mutable Nodes                           m_nodes;
+		size_t                                  m_subdirs;
+		mutable std::vector<LazyIndex::Block>   m_blocks;
+		LazyIndexPtr                            m_index;
+		CompactTree::Id                         m_treeDir;
+		mutable std::atomic<bool>               m_loaded;
 	};
 }
 
@@ -0,0 +1,95 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_EXTRACTION_PLAN_H
+#define VPK_EXTRACTION_PLAN_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <vpk/visitor.h>
+
+namespace Vpk {
+	class Dir;
+	class File;
+
+	// Orders files by their location in the archives, so each archive is
+	// read front to back instead of in hash order, and merges files that
+	// are stored back to back into extents that are read at once.
+	//
+	// Usage: add() files, build() and pass the plan to Package::process.
+	class ExtractionPlan {
+	public:
+		enum { DEFAULT_MAX_EXTENT_SIZE = 1024 * 1024 };
+
+		struct Entry {
+			Entry(const std::string &path, const File *file) : path(path), file(file) {}
+			Entry(PathRef path, const File *file) : path(path.data(), path.size()), file(file) {}
+
+			std::string path;
+			const File *file;
+		};
+
+		// A run of entries in one archive that is read with a single read.
+		// Entries that consist only of preload data are grouped into
+		// extents of size 0. A file bigger than the maximum extent size
+		// gets an extent of its own and is read in chunks.
+		struct Extent {
+			uint16_t index;
+			uint32_t offset;
+			size_t   size;
+			size_t   first;
+			size_t   count;
+		};
+
+		typedef std::vector<Entry>       Entries;
+		typedef std::vector<Extent>      Extents;
+		typedef std::vector<std::string> Dirs;
+
+		ExtractionPlan(size_t maxExtentSize = DEFAULT_MAX_EXTENT_SIZE) :
+			m_maxExtentSize(maxExtentSize) {}
+
+		// adds all files below dir, paths are prefixed with prefix
+		void add(const Dir &dir, const std::string &prefix = std::string());
+		void add(const std::string &path, const File *file) { m_entries.push_back(Entry(path, file)); }
+		void add(PathRef path, const File *file) { m_entries.push_back(Entry(path, file)); }
+
+		// sorts the entries by (archive index, offset) and merges extents
+		void build();
+		void clear();
+
+		const Entries &entries() const { return m_entries; }
+		const Extents &extents() const { return m_extents; }
+
+		// all directories that contain entries, parents sort before children
+		const Dirs &dirs() const { return m_dirs; }
+
+		size_t maxExtentSize() const { return m_maxExtentSize; }
+		bool   empty() const { return m_entries.empty(); }
+
+	private:
+		Entries m_entries;
+		Extents m_extents;
+		Dirs    m_dirs;
+		size_t  m_maxExtentSize;
+	};
+}
+
+#endif
@@ -26,6 +26,7 @@
 
 #include <vpk/node.h>
 #include <vpk/file_io.h>
+#include <vpk/mem_reader.h>
 
 namespace Vpk {
 	class File : public Node {
@@ -40,15 +41,20 @@ namespace Vpk {
 			size(size),
 			offset(offset),
 			index(index),
+			preloadOffset(0),
 			preload(0, 0) {}
 
 		Type type() const { return Node::FILE; }
 		void read(FileIO &io, std::vector<File*> &dirfiles);
+		void read(MemReader &io, std::vector<File*> &dirfiles);
 
 		uint32_t crc32;
 		uint32_t size;
 		uint32_t offset;
 		uint16_t index;
+		// where the preload data is in the _dir.vpk file, 0 if there is
+		// none
+		uint32_t preloadOffset;
 		std::vector<char> preload;
 	};
 
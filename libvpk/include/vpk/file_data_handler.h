@@ -19,7 +19,6 @@
 #ifndef VPK_FILE_DATA_HANDLER_H
 #define VPK_FILE_DATA_HANDLER_H
 
-#include <boost/crc.hpp>
 
 #include <vpk/checking_data_handler.h>
 #include <vpk/file_io.h>
@@ -29,21 +28,30 @@ namespace Vpk {
 	public:
 		typedef CheckingDataHandler super_type;
 
-		FileDataHandler(const boost::filesystem::path &path, uint32_t crc32, bool check);
+		// Checked data is hashed and then written in chunks of up to this
+		// size. A chunk is still in the cache when it is written, and big
+		// files don't cost more write() calls than unchecked ones.
+		enum { WRITE_SIZE = 4 * 1024 * 1024 };
 
-		void process(const char *buffer, size_t length) {
-			if (m_check) super_type::process(buffer, length);
-			m_io.write(buffer, length);
-		}
+		// Creates the file name relative to the directory dirfd with a
+		// single openat(), the directory has to exist already. path is
+		// only used for messages. See FileDataHandlerFactory.
+		FileDataHandler(int dirfd, const char *name, const boost::filesystem::path &path,
+			uint32_t crc32, bool check);
 
-		void finish() {
-			m_io.close();
-			if (m_check) super_type::finish();
-		}
+		void process(const char *buffer, size_t length);
+
+		// copies in the kernel, unless the data has to be checked
+		size_t copy(int fd, off_t offset, size_t length);
+
+		void finish();
 
 		bool check() const { return m_check; }
 	
 	private:
+		void open(int fd);
+		void write(const char *buffer, size_t length);
+
 		bool   m_check;
 		FileIO m_io;
 	};
@@ -19,29 +19,76 @@
 #ifndef VPK_FILE_DATA_HANDLER_FACTORY_H
 #define VPK_FILE_DATA_HANDLER_FACTORY_H
 
+#include <mutex>
+#include <list>
+
+#include <boost/unordered_map.hpp>
+
 #include <vpk/file_data_handler.h>
 #include <vpk/data_handler_factory.h>
 
 namespace Vpk {
 	class FileDataHandlerFactory : public DataHandlerFactory {
 	public:
+		// At most this many directories are kept open, the one used least
+		// recently is closed to make room. A closed directory is opened
+		// again relative to destdir when it is needed.
+		enum { MAX_DIR_FDS = 256 };
+
 		FileDataHandlerFactory(const std::string &destdir, bool check)
-		: m_destdir(destdir), m_check(check) {}
+		: m_destdir(destdir), m_check(check), m_root(-1) {}
+
+		~FileDataHandlerFactory();
 
 		FileDataHandler *create(const boost::filesystem::path &path, uint32_t crc32) {
-			return new FileDataHandler(m_destdir / path, crc32, m_check);
+			return create(path.string(), crc32);
 		}
 
-		FileDataHandler *create(const std::string &path, uint32_t crc32) {
-			return new FileDataHandler(m_destdir / path, crc32, m_check);
-		}
+		// Each directory is created only once (see mkdir()), after that
+		// creating a file costs a single openat().
+		FileDataHandler *create(const std::string &path, uint32_t crc32);
+
+		// Creates the directory and all missing parents with mkdirat() and
+		// remembers them. Safe to call from several threads.
+		void mkdir(const std::string &path);
+
+		// without checking the data never has to be in memory
+		bool zeroCopy() const { return !m_check; }
 
 		const boost::filesystem::path &destdir() const { return m_destdir; }
 		bool check() const { return m_check; }
 	
 	private:
+		FileDataHandlerFactory(const FileDataHandlerFactory&);
+		FileDataHandlerFactory &operator = (const FileDataHandlerFactory&);
+
+		struct Dir;
+		typedef std::list<Dir*> Lru;
+
+		// a directory that was created
+		struct Dir {
+			Dir() : fd(-1), users(0) {}
+
+			int           fd;    // -1 while it isn't open
+			size_t        users; // files being created in it, it stays open
+			Lru::iterator lru;   // position in m_lru while it is open
+		};
+
+		// relative directory path -> directory
+		typedef boost::unordered_map<std::string, Dir> Dirs;
+
+		// Returns the directory path relative to destdir ("" is destdir
+		// itself), created and open. Call with m_mutex locked.
+		Dir &dir(const std::string &path);
+		// opens dir as name relative to the directory fd parent
+		void open(Dir &dir, int parent, const char *name);
+
 		boost::filesystem::path m_destdir;
 		bool                    m_check;
+		std::mutex              m_mutex;
+		Dirs                    m_dirs;
+		Lru                     m_lru; // open directories, most recently used first
+		int                     m_root;
 	};
 }
 
@@ -0,0 +1,80 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_HEADER_H
+#define VPK_HEADER_H
+
+#include <boost/format.hpp>
+
+#include <vpk/file_io.h>
+#include <vpk/file_format_error.h>
+
+namespace Vpk {
+	// The optional header at the start of a *_dir.vpk file. Version 0 means
+	// the file has no header and the index starts right at the beginning.
+	class Header {
+	public:
+		enum { MAGIC = 0x55AA1234 };
+
+		Header() : version(0), indexSize(0), headerSize(0), footerOffset(0), footerSize(0) {}
+
+		// works with FileIO and MemReader
+		template<typename Reader>
+		void read(Reader &io);
+
+		// only meaningful for version > 0
+		unsigned int dataOffset() const { return indexSize + headerSize; } // + footerSize?
+
+		unsigned int version;
+		unsigned int indexSize;
+		unsigned int headerSize;
+		unsigned int footerOffset;
+		unsigned int footerSize;
+	};
+
+	template<typename Reader>
+	void Header::read(Reader &io) {
+		version      = 0;
+		indexSize    = 0;
+		headerSize   = 0;
+		footerOffset = 0;
+		footerSize   = 0;
+
+		if (io.readLU32() != MAGIC) {
+			io.seek(-4, FileIO::CUR);
+		}
+		else {
+			version    = io.readLU32();
+			indexSize  = io.readLU32();
+			headerSize = io.tell();
+
+			if (version == 2) {
+				footerOffset = io.readLU32();
+				io.readLU32(); // UNKNOWN
+				footerSize = io.readLU32();
+				io.readLU32(); // UNKNOWN
+			}
+			else if (version != 1) {
+				throw FileFormatError((boost::format("unsupported VPK version: %u")
+					% version).str());
+			}
+		}
+	}
+}
+
+#endif
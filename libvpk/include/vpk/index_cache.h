@@ -0,0 +1,102 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_INDEX_CACHE_H
+#define VPK_INDEX_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include <vpk/compact_tree.h>
+
+namespace Vpk {
+	// On-disk cache of parsed *_dir.vpk indices in the CompactTree layout.
+	// Loading a cached index maps the cache file and uses the records in
+	// place, so nothing is parsed or rebuilt.
+	//
+	// A cache file is only used if the size, mtime and inode of the dir
+	// file and a CRC-32 of the start and end of its index match the values
+	// recorded when it was written, and a CRC-32 of its own header and end
+	// is correct. Anything else (other archive, other libvpk build,
+	// truncated cache) makes read() parse the dir file and rewrite the
+	// cache. Cache files are written to a temporary file and renamed, so a
+	// reader never sees a partial file.
+	//
+	// A load doesn't touch more of either file than that. Damage in the
+	// middle of a cache file, which could make lookups run out of the
+	// mapping, is only caught in verify mode: it hashes the whole index
+	// and cache file and checks every record.
+	//
+	// Package::read() keeps a hit mapped and builds the Dir/File nodes of
+	// a dir from it only when the dir is accessed.
+	class IndexCache {
+	public:
+		struct Key {
+			Key() : size(0), mtime(0), mtimeNsec(0), inode(0), crc32(0) {}
+
+			bool operator == (const Key &other) const;
+			bool operator != (const Key &other) const { return !(*this == other); }
+
+			uint64_t size;
+			int64_t  mtime;
+			int64_t  mtimeNsec;
+			uint64_t inode;
+			uint32_t crc32; // of the start and end of the index
+		};
+
+		// uses defaultDir()
+		IndexCache();
+		IndexCache(const boost::filesystem::path &dir) : m_dir(dir), m_verify(false) {}
+
+		// $XDG_CACHE_HOME/vpk or ~/.cache/vpk
+		static boost::filesystem::path defaultDir();
+
+		const boost::filesystem::path &dir() const { return m_dir; }
+
+		void setVerify(bool verify) { m_verify = verify; }
+		bool verify() const { return m_verify; }
+
+		// the cache file used for the given dir file
+		boost::filesystem::path cacheFile(const boost::filesystem::path &dirfile) const;
+
+		// Loads the index of dirfile into tree, from the cache if it is up to
+		// date, otherwise by parsing dirfile and updating the cache. Returns
+		// true on a cache hit. Failing to write the cache is only a warning.
+		bool read(const boost::filesystem::path &dirfile, CompactTree &tree) const;
+
+		// only tries the cache, returns false if it is missing or stale
+		bool load(const boost::filesystem::path &dirfile, CompactTree &tree) const;
+
+		// may throw Vpk::IOError
+		void save(const boost::filesystem::path &dirfile, const CompactTree &tree) const;
+
+	private:
+		// maps dirfile and computes its key
+		static Key key(const boost::filesystem::path &dirfile, MMap &map);
+
+		bool load(const boost::filesystem::path &cachefile, const Key &key, const MMap &dirmap, CompactTree &tree) const;
+		void save(const boost::filesystem::path &cachefile, const Key &key, const MMap &dirmap, const CompactTree &tree) const;
+
+		boost::filesystem::path m_dir;
+		bool                    m_verify;
+	};
+}
+
+#endif
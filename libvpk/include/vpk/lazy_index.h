@@ -0,0 +1,71 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_LAZY_INDEX_H
+#define VPK_LAZY_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <set>
+#include <mutex>
+
+#include <boost/shared_ptr.hpp>
+
+#include <vpk/mmap.h>
+#include <vpk/compact_tree.h>
+
+namespace Vpk {
+	// The mapped *_dir.vpk of a lazily read Package. Reading only records
+	// where the file lists of each dir are; a Dir decodes them from here the
+	// first time it is accessed.
+	//
+	// A Package read through an IndexCache keeps the CompactTree here
+	// instead (mapped on a hit, parsed on a miss in lazy mode) and its dirs
+	// build their files from its records.
+	class LazyIndex {
+	public:
+		// the file list of one (type, dir path) pair, all offsets point
+		// into the mapping
+		struct Block {
+			uint32_t type;
+			uint32_t path;
+			uint32_t files;
+		};
+
+		LazyIndex() : dataOffset(0), files(0), dirs(0) {}
+		LazyIndex(int fd) : map(fd), dataOffset(0), files(0), dirs(0) {}
+
+		MMap         map;
+		unsigned int dataOffset;
+		CompactTree  tree;
+
+		// serializes decoding
+		std::mutex   mutex;
+
+		// counted while scanning the index, archives only holds the
+		// indices of files that have data besides their preload data
+		size_t             files;
+		size_t             dirs;
+		std::set<uint16_t> archives;
+	};
+
+	typedef boost::shared_ptr<LazyIndex> LazyIndexPtr;
+}
+
+#endif
@@ -0,0 +1,124 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_MEM_READER_H
+#define VPK_MEM_READER_H
+
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <endian.h>
+
+#include <string>
+
+#include <vpk/file_io.h>
+#include <vpk/io_error.h>
+
+namespace Vpk {
+	// reads little endian values and strings directly from a memory
+	// region (e.g. a MMap) using the same interface as FileIO
+	//
+	// all read operations throw Vpk::IOError(EOF) when reading past the end
+	class MemReader {
+	public:
+		MemReader(const char *begin, const char *end) :
+			m_begin(begin), m_end(end), m_ptr(begin) {}
+
+		off_t tell() const { return m_ptr - m_begin; }
+		size_t left() const { return m_end - m_ptr; }
+		bool eof() const { return m_ptr >= m_end; }
+		const char *ptr() const { return m_ptr; }
+
+		void seek(off_t offset, FileIO::Whence whence);
+		void seek(off_t offset) { seek(offset, FileIO::CUR); }
+
+		// returns a pointer to the next size bytes and skips them
+		const char *take(size_t size) {
+			if (left() < size) throw IOError(EOF);
+			const char *data = m_ptr;
+			m_ptr += size;
+			return data;
+		}
+
+		void read(char *buf, size_t size) { memcpy(buf, take(size), size); }
+
+		uint8_t  readU8()   { return (uint8_t) *take(1); }
+		uint16_t readLU16() { return lu16(take(2)); }
+		uint32_t readLU32() { return lu32(take(4)); }
+		uint64_t readLU64() { return lu64(take(8)); }
+
+		// returns a pointer to the NUL terminated string at the current
+		// position and skips it (including the terminator)
+		const char *readAsciiZ(size_t &length) {
+			const char *str = m_ptr;
+			const char *nul = (const char*) memchr(str, 0, left());
+			if (!nul) throw IOError(EOF);
+			length = nul - str;
+			m_ptr = nul + 1;
+			return str;
+		}
+
+		void readAsciiZ(std::string &s) {
+			size_t length = 0;
+			const char *str = readAsciiZ(length);
+			s.append(str, length);
+		}
+
+		std::string readAsciiZ() {
+			size_t length = 0;
+			const char *str = readAsciiZ(length);
+			return std::string(str, length);
+		}
+
+		// unaligned little endian decoding
+		static uint16_t lu16(const char *data) {
+			uint16_t value;
+			memcpy(&value, data, sizeof(value));
+			return le16toh(value);
+		}
+
+		static uint32_t lu32(const char *data) {
+			uint32_t value;
+			memcpy(&value, data, sizeof(value));
+			return le32toh(value);
+		}
+
+		static uint64_t lu64(const char *data) {
+			uint64_t value;
+			memcpy(&value, data, sizeof(value));
+			return le64toh(value);
+		}
+
+	private:
+		const char *m_begin;
+		const char *m_end;
+		const char *m_ptr;
+	};
+
+	inline void MemReader::seek(off_t offset, FileIO::Whence whence) {
+		const char *base = whence == FileIO::SET ? m_begin :
+		                   whence == FileIO::END ? m_end : m_ptr;
+		if (offset < m_begin - base || offset > m_end - base) {
+			throw IOError(EINVAL);
+		}
+		m_ptr = base + offset;
+	}
+}
+
+#endif
@@ -0,0 +1,63 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_MMAP_H
+#define VPK_MMAP_H
+
+#include <stddef.h>
+
+#include <boost/filesystem/path.hpp>
+
+namespace Vpk {
+	// read-only memory mapping of a whole file
+	//
+	// open may throw Vpk::IOError, e.g. when the file is not a regular file
+	// (pipes etc.) and thus can't be mapped.
+	class MMap {
+	public:
+		MMap() : m_data(0), m_size(0) {}
+		MMap(int fd) : m_data(0), m_size(0) { open(fd); }
+		MMap(const boost::filesystem::path &path) : m_data(0), m_size(0) { open(path); }
+		~MMap() { close(); }
+
+		void open(int fd);
+		void open(const boost::filesystem::path &path);
+		void close();
+
+		// hint the kernel about the access pattern, see madvise(2)
+		void advise(int advice);
+		void advise(size_t offset, size_t size, int advice) const;
+
+		bool opened() const { return m_data != 0; }
+		const char *data() const { return m_data; }
+		const char *begin() const { return m_data; }
+		const char *end() const { return m_data + m_size; }
+		size_t size() const { return m_size; }
+
+		static bool mappable(int fd);
+
+	private:
+		MMap(const MMap&);
+		MMap &operator = (const MMap&);
+
+		const char *m_data;
+		size_t      m_size;
+	};
+}
+
+#endif
@@ -19,6 +19,8 @@
 #ifndef VPK_NODE_H
 #define VPK_NODE_H
 
+#include <stdint.h>
+
 #include <iostream>
 #include <string>
 
@@ -33,7 +35,7 @@ namespace Vpk {
 			DIR
 		};
 
-		Node(const std::string& name) : m_name(name) {}
+		Node(const std::string& name) : m_name(name), m_inode(0) {}
 		virtual ~Node() {}
 		
 		virtual Type type() const = 0;
@@ -41,8 +43,14 @@ namespace Vpk {
 		void setName(const std::string &name) { m_name = name; }
 		const std::string &name() const { return m_name; }
 
+		// only used by vpkfs, which numbers the nodes for the FUSE
+		// low-level API. 0 means not numbered.
+		void setInode(uint64_t inode) { m_inode = inode; }
+		uint64_t inode() const { return m_inode; }
+
 	private:
 		std::string m_name;
+		uint64_t    m_inode;
 	};
 
 	typedef boost::shared_ptr<Node>                   NodePtr;
@@ -30,16 +30,25 @@
 #include <vpk/node.h>
 #include <vpk/dir.h>
 #include <vpk/handler.h>
+#include <vpk/stats_handler.h>
+#include <vpk/profile.h>
 #include <vpk/data_handler_factory.h>
+#include <vpk/extraction_plan.h>
+#include <vpk/path_index.h>
 #include <vpk/file_io.h>
+#include <vpk/async_reader.h>
 
 namespace Vpk {
 	class File;
+	class CompactTree;
+	class IndexCache;
 
 	class Package : public Dir {
 	public:
 		Package(Handler *handler = 0) :
-			Dir(""), m_version(0), m_dataOffset(0), m_footerOffset(0), m_footerSize(0), m_srcdir("."), m_handler(handler) {}
+			Dir(""), m_version(0), m_dataOffset(0), m_footerOffset(0), m_footerSize(0), m_srcdir("."), m_handler(handler),
+			m_indexed(false), m_lazy(false), m_readDepth(AsyncReader::DEFAULT_DEPTH),
+			m_readBackend(AsyncReader::IO_URING), m_mapped(false), m_statsHandler(0) {}
 
 		void read(const char *path) { read(boost::filesystem::path(path)); }
 		void read(const std::string &path) { read(boost::filesystem::path(path)); }
@@ -48,6 +57,16 @@ namespace Vpk {
 		void read(const std::string &path, FileIO &io) { read(boost::filesystem::path(path), io); }
 		void read(const boost::filesystem::path &path, FileIO &io);
 
+		// Reads the index through an index cache. On a cache hit nothing is
+		// parsed and only the dirs are built, the files of a dir are built
+		// from the mapped records the first time it is accessed (see
+		// lazyIndex()). In lazy mode a cache miss keeps the parsed
+		// CompactTree and is built the same way.
+		void read(const boost::filesystem::path &path, const IndexCache &cache);
+
+		// builds all nodes from the tree
+		void read(const CompactTree &tree);
+
 		Dir &mkpath(const std::string &path) { return mkpath(path.c_str()); }
 		Dir &mkpath(const char *path);
 
@@ -61,13 +80,63 @@ namespace Vpk {
 		const std::string &dirfile() const { return m_dirfile; }
 		Node *get(const std::string &path) { return get(path.c_str()); }
 		Node *get(const char *path);
+
+		// Builds a full path -> node index that get() uses from then on.
+		// read() drops the index and filter() rebuilds it, other changes
+		// to the tree (mkpath(), Dir::add()) need another buildIndex().
+		void buildIndex() { m_index.build(*this); m_indexed = true; }
+		void clearIndex() { m_index.clear(); m_indexed = false; }
+		bool indexed() const { return m_indexed; }
+		const PathIndex &index() const { return m_index; }
+
 		void setHandler(Handler *handler) { m_handler = handler; }
+
+		// In lazy mode read() only scans the index and the file lists of a
+		// dir are decoded when it is accessed for the first time. This only
+		// works for dir files that can be mapped, others are read eagerly.
+		// Reading through an index cache keeps the CompactTree instead.
+		void setLazy(bool lazy) { m_lazy = lazy; }
+		bool lazy() const { return m_lazy; }
+
+		// the index of the last lazy read() or index cache hit, 0 otherwise
+		const LazyIndex *lazyIndex() const { return m_lazyIndex.get(); }
+
 		const Handler *handler() const { return m_handler; }
 
+		// With a stats handler read() and process() time their phases and
+		// count what they do, see Profile. Setting a handler starts over.
+		void setStatsHandler(StatsHandler *handler);
+		const StatsHandler *statsHandler() const { return m_statsHandler; }
+
+		// the profiler of the stats handler, 0 without one
+		Profiler *profiler() const { return m_profiler.get(); }
+
+		// How process() reads archives: up to depth reads per thread are
+		// in flight, see AsyncReader. Depth 1 reads one extent at a time.
+		void setReadDepth(unsigned int depth) { m_readDepth = depth; }
+		unsigned int readDepth() const { return m_readDepth; }
+		void setReadBackend(AsyncReader::Backend backend) { m_readBackend = backend; }
+		AsyncReader::Backend readBackend() const { return m_readBackend; }
+
+		// Maps the archives instead of reading them, see ArchiveSet. Data
+		// handlers are fed straight from the mappings then and the read
+		// depth and backend are ignored.
+		void setMapped(bool mapped) { m_mapped = mapped; }
+		bool mapped() const { return m_mapped; }
+
 		void filter(const std::vector<std::string> &paths);
 		void extract(const std::string &destdir, bool check = false) const;
+		void extract(const std::string &destdir, bool check, unsigned int threads) const;
 		void check() const;
+		void check(unsigned int threads) const;
 		void process(DataHandlerFactory &factory) const;
+		void process(DataHandlerFactory &factory, unsigned int threads) const;
+
+		// Processes the files of the plan in plan order. With more than one
+		// thread extents are read and processed by worker threads, so the
+		// factory has to be thread safe. Handler callbacks are always invoked
+		// from the calling thread and in plan order.
+		void process(const ExtractionPlan &plan, DataHandlerFactory &factory, unsigned int threads = 1) const;
 
 		size_t filecount() const;
 
@@ -76,9 +145,11 @@ namespace Vpk {
 	private:
 		typedef bool (Handler::*ErrorMethod)(const std::exception &exc, const std::string &path);
 
+		void setPath(const boost::filesystem::path &path);
 		void read(FileIO &io);
+		template<typename Reader> void readIndex(Reader &io);
+		void defer(const LazyIndexPtr &index);
 		void filter(Dir &dir, const std::set<Node*> &keep);
-		void process(const Nodes &nodes, const std::vector<std::string> &prefix, Archives &archives, DataHandlerFactory &factory) const;
 
 		bool direrror(const std::exception &exc, const std::string &path)     const { return error(exc, path, &Handler::direrror); }
 		bool fileerror(const std::exception &exc, const std::string &path)    const { return error(exc, path, &Handler::fileerror); }
@@ -93,6 +164,10 @@ namespace Vpk {
 		bool error(const std::string &msg, const std::string &path, ErrorMethod handler) const;
 		bool error(const std::exception &exc, const std::string &path, ErrorMethod handler) const;
 
+		void stats() const {
+			if (m_statsHandler) m_statsHandler->stats(*this, m_profiler->profile());
+		}
+
 		unsigned int m_version;
 		unsigned int m_dataOffset;
 		unsigned int m_footerOffset;
@@ -100,6 +175,15 @@ namespace Vpk {
 		std::string  m_srcdir;
 		std::string  m_dirfile;
 		Handler     *m_handler;
+		PathIndex    m_index;
+		bool         m_indexed;
+		bool         m_lazy;
+		LazyIndexPtr m_lazyIndex;
+		unsigned int m_readDepth;
+		AsyncReader::Backend m_readBackend;
+		bool         m_mapped;
+		StatsHandler *m_statsHandler;
+		boost::shared_ptr<Profiler> m_profiler;
 	};
 }
 
@@ -0,0 +1,75 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_PATH_INDEX_H
+#define VPK_PATH_INDEX_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace Vpk {
+	class Node;
+	class Dir;
+
+	// Maps full paths ("dir/sub/file.ext": no leading, trailing or double
+	// slashes) to nodes with a single hash lookup. All keys are stored back
+	// to back in one buffer and the table uses open addressing, so lookups
+	// don't allocate. The index doesn't own the nodes and has to be rebuilt
+	// when the tree changes.
+	class PathIndex {
+	public:
+		PathIndex() : m_size(0) {}
+
+		void build(Dir &root);
+		void clear();
+
+		// path has to be normalized, returns 0 if there is no such node
+		Node *get(const char *path, size_t length) const;
+		Node *get(const char *path) const { return get(path, strlen(path)); }
+
+		static bool normalized(const char *path, size_t length);
+
+		bool   empty() const { return m_size == 0; }
+		size_t size()  const { return m_size; }
+		size_t memoryUsage() const;
+
+	private:
+		struct Slot {
+			Slot() : node(0), hash(0), key(0), length(0) {}
+
+			Node    *node;
+			uint32_t hash;
+			uint32_t key;
+			uint32_t length;
+		};
+
+		static uint32_t hash(const char *path, size_t length);
+
+		void build(Dir &dir, std::string &path);
+		void insert(const std::string &path, Node *node);
+
+		std::vector<Slot> m_slots;
+		std::vector<char> m_keys;
+		size_t            m_size;
+	};
+}
+
+#endif
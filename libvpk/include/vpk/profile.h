@@ -0,0 +1,140 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_PROFILE_H
+#define VPK_PROFILE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+
+namespace Vpk {
+	// Timers and counters of reading and processing a package, see
+	// Package::setStatsHandler(). Times of worker threads add up, so with
+	// more than one thread the phases can take longer than the whole run.
+	struct Profile {
+		enum Phase {
+			INDEX, // parsing the index
+			PLAN,  // collecting the paths of all files and sorting them
+			MKDIR, // creating directories
+			OPEN,  // creating files
+			READ,  // reading archives, including waiting for asynchronous reads
+			CHECK, // computing CRC32 sums
+			WRITE, // writing files
+			PHASES
+		};
+
+		enum Counter {
+			BYTES_READ,
+			BYTES_WRITTEN,
+			SYSCALLS, // the reads, writes, opens, stats and mkdirs listed above
+			FILES_OPENED,
+			MKDIRS,
+			COUNTERS
+		};
+
+		Profile() { clear(); }
+
+		void clear();
+
+		static const char *name(Phase phase);
+		static const char *name(Counter counter);
+
+		uint64_t time[PHASES]; // nanoseconds
+		uint64_t calls[PHASES];
+		uint64_t counters[COUNTERS];
+	};
+
+	// Collects a Profile. Instrumented code reports to the profiler of the
+	// calling thread, which is set with an Activation. Without one timers
+	// and counters cost a thread local lookup and a branch.
+	class Profiler {
+	public:
+		Profiler() { clear(); }
+
+		Profile profile() const;
+		void clear();
+
+		void add(Profile::Phase phase, uint64_t nanos) {
+			m_time[phase].fetch_add(nanos, std::memory_order_relaxed);
+			m_calls[phase].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		void add(Profile::Counter counter, uint64_t value) {
+			m_counters[counter].fetch_add(value, std::memory_order_relaxed);
+		}
+
+		static Profiler *current() { return s_current; }
+
+		static void count(Profile::Counter counter, uint64_t value = 1) {
+			Profiler *profiler = s_current;
+			if (profiler) profiler->add(counter, value);
+		}
+
+		static uint64_t now() {
+			struct timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		}
+
+		// makes profiler the one of the calling thread for its lifetime,
+		// does nothing if profiler is 0
+		class Activation {
+		public:
+			Activation(Profiler *profiler) : m_previous(s_current) {
+				if (profiler) s_current = profiler;
+			}
+			~Activation() { s_current = m_previous; }
+
+		private:
+			Activation(const Activation&);
+			Activation &operator = (const Activation&);
+
+			Profiler *m_previous;
+		};
+
+		// times the enclosing scope as phase
+		class Timer {
+		public:
+			Timer(Profile::Phase phase) : m_profiler(s_current), m_phase(phase),
+				m_start(m_profiler ? now() : 0) {}
+			~Timer() { if (m_profiler) m_profiler->add(m_phase, now() - m_start); }
+
+		private:
+			Timer(const Timer&);
+			Timer &operator = (const Timer&);
+
+			Profiler      *m_profiler;
+			Profile::Phase m_phase;
+			uint64_t       m_start;
+		};
+
+	private:
+		Profiler(const Profiler&);
+		Profiler &operator = (const Profiler&);
+
+		static thread_local Profiler *s_current;
+
+		std::atomic<uint64_t> m_time[Profile::PHASES];
+		std::atomic<uint64_t> m_calls[Profile::PHASES];
+		std::atomic<uint64_t> m_counters[Profile::COUNTERS];
+	};
+}
+
+#endif
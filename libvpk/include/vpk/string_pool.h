@@ -0,0 +1,99 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_STRING_POOL_H
+#define VPK_STRING_POOL_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/unordered_set.hpp>
+
+namespace Vpk {
+	// All strings are stored NUL terminated in one contiguous buffer and are
+	// addressed by their byte offset. Equal strings are only stored once.
+	// Offset 0 is always the empty string.
+	class StringPool {
+	public:
+		typedef uint32_t Id;
+
+		StringPool();
+		StringPool(const StringPool &other);
+		StringPool &operator = (const StringPool &other);
+
+		Id intern(const char *str, size_t length);
+		Id intern(const char *str) { return intern(str, strlen(str)); }
+		Id intern(const std::string &str) { return intern(str.c_str(), str.size()); }
+
+		const char *get(Id id) const { return &m_data[id]; }
+		const char *operator [] (Id id) const { return get(id); }
+
+		// total size of all strings including terminators
+		size_t size() const { return m_data.size(); }
+		const std::vector<char> &data() const { return m_data; }
+
+		// drop the lookup table once all strings are added
+		void freeze();
+		bool frozen() const { return m_frozen; }
+
+		void clear();
+		void reserve(size_t size) { m_data.reserve(size); }
+
+		size_t memoryUsage() const;
+
+	private:
+		struct Key {
+			Key(const char *str, size_t length) : str(str), length(length) {}
+
+			const char *str;
+			size_t      length;
+		};
+
+		struct Hash {
+			Hash(const std::vector<char> *data) : data(data) {}
+
+			size_t operator () (Id id) const;
+			size_t operator () (const Key &key) const;
+
+			const std::vector<char> *data;
+		};
+
+		struct Equal {
+			Equal(const std::vector<char> *data) : data(data) {}
+
+			bool operator () (Id lhs, Id rhs) const { return lhs == rhs; }
+			bool operator () (const Key &lhs, Id rhs) const;
+			bool operator () (Id lhs, const Key &rhs) const { return (*this)(rhs, lhs); }
+
+			const std::vector<char> *data;
+		};
+
+		typedef boost::unordered_set<Id, Hash, Equal> Index;
+
+		void reindex();
+
+		std::vector<char> m_data;
+		Index             m_index;
+		bool              m_frozen;
+	};
+}
+
+#endif
@@ -0,0 +1,105 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_TREE_ITERATOR_H
+#define VPK_TREE_ITERATOR_H
+
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+#include <vpk/node.h>
+
+namespace Vpk {
+	class Dir;
+	class File;
+
+	// A path into the buffer of a traversal. It is only valid until the
+	// traversal moves on, copy it to keep it.
+	typedef boost::string_ref PathRef;
+
+	// Walks the tree below a dir depth first without recursion. Each call
+	// of next() moves to the next step:
+	//
+	//   FILE   a file
+	//   ENTER  a dir, its contents follow unless prune() is called
+	//   LEAVE  after the contents of a dir (not after prune())
+	//
+	// The path of the current node is built in one buffer that is appended
+	// to and truncated as the walk goes down and back up, and the pending
+	// dirs are kept on an explicit stack. Neither grows once the deepest
+	// dir was seen, so a step doesn't allocate anything.
+	//
+	// Usage:
+	//
+	//   TreeIterator it(package);
+	//   while (it.next()) {
+	//       if (it.step() == TreeIterator::FILE) use(it.path(), it.file());
+	//   }
+	class TreeIterator {
+	public:
+		enum Step {
+			FILE,
+			ENTER,
+			LEAVE
+		};
+
+		// Paths are relative to dir and prefixed with prefix + "/" if
+		// prefix isn't empty. The root itself is not a step.
+		TreeIterator(const Dir &dir, const std::string &prefix = std::string());
+		TreeIterator(const Nodes &nodes, const std::string &prefix = std::string());
+
+		// Returns false when all nodes were visited.
+		bool next();
+
+		// Skip the contents of the dir of the current ENTER step.
+		void prune() { m_pruned = true; }
+
+		Step        step()  const { return m_step; }
+		const Node &node()  const { return *m_node; }
+		const Dir  &dir()   const { return *(const Dir*) m_node; }
+		const File &file()  const { return *(const File*) m_node; }
+		PathRef     path()  const { return PathRef(m_path); }
+
+		// 0 for the nodes directly below the root and after the end
+		size_t      depth() const { return m_stack.empty() ? 0 : m_stack.size() - 1; }
+
+	private:
+		struct Frame {
+			Frame(const Dir *dir, const Nodes &nodes, size_t length) :
+				dir(dir), it(nodes.begin()), end(nodes.end()), length(length) {}
+
+			const Dir            *dir;
+			Nodes::const_iterator it;
+			Nodes::const_iterator end;
+			// length of the path of dir
+			size_t                length;
+		};
+
+		void init(const Nodes &nodes, const std::string &prefix);
+
+		std::vector<Frame> m_stack;
+		std::string        m_path;
+		const Node        *m_node;
+		Step               m_step;
+		bool               m_pruned;
+	};
+}
+
+#endif
@@ -19,6 +19,8 @@
 #ifndef VPK_UTIL_H
 #define VPK_UTIL_H
 
+#include <sys/types.h>
+
 #include <string>
 
 #include <boost/filesystem.hpp>
@@ -27,6 +29,13 @@ namespace Vpk {
 	std::string tolower(const std::string &s);
 	std::string &tolower(std::string &s);
 	void create_path(const boost::filesystem::path &path);
+
+	// Copies size bytes at offset of infd to the current position of outfd
+	// without moving them through user space (copy_file_range() or
+	// sendfile()). Returns the number of bytes copied. This is less than
+	// size only if the kernel can't copy between these two files, the
+	// caller has to copy the rest itself. Throws Vpk::IOError on errors.
+	size_t copy_range(int infd, off_t offset, int outfd, size_t size);
 }
 
 #endif
@@ -0,0 +1,60 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_VISITOR_H
+#define VPK_VISITOR_H
+
+#include <string>
+
+#include <vpk/node.h>
+#include <vpk/tree_iterator.h>
+
+namespace Vpk {
+	class Dir;
+	class File;
+
+	// Callbacks for visit(). Paths are only valid until the callback
+	// returns, see TreeIterator.
+	class Visitor {
+	public:
+		virtual ~Visitor() {}
+
+		// Return false to skip everything below dir.
+		virtual bool enter(PathRef path, const Dir &dir) {
+			(void) path;
+			(void) dir;
+			return true;
+		}
+
+		// Called after everything below dir was visited, but not if
+		// enter() returned false.
+		virtual void leave(PathRef path, const Dir &dir) {
+			(void) path;
+			(void) dir;
+		}
+
+		virtual void file(PathRef path, const File &file) = 0;
+	};
+
+	// Visits all nodes below dir depth first. Paths are relative to dir
+	// and prefixed with prefix + "/" if prefix isn't empty.
+	void visit(const Dir &dir, Visitor &visitor, const std::string &prefix = std::string());
+	void visit(const Nodes &nodes, Visitor &visitor, const std::string &prefix = std::string());
+}
+
+#endif
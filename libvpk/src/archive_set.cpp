@@ -0,0 +1,87 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <boost/filesystem/operations.hpp>
+
+#include <vpk/archive_set.h>
+#include <vpk/package.h>
+#include <vpk/file.h>
+#include <vpk/io_error.h>
+
+namespace fs = boost::filesystem;
+
+void Vpk::ArchiveSet::map(uint16_t index) {
+	if (mapped(index)) return;
+
+	Archive &archive = m_archives[index];
+	fs::path archivePath(m_package.archivePath(index));
+	if (!fs::exists(archivePath)) {
+		archive.error = std::make_exception_ptr(Exception("archive does not exist"));
+		return;
+	}
+
+	try {
+		boost::shared_ptr<MMap> map(new MMap(archivePath));
+		map->advise(m_advice);
+		archive.map = map;
+	}
+	catch (...) {
+		archive.error = std::current_exception();
+	}
+}
+
+void Vpk::ArchiveSet::map(const ExtractionPlan &plan) {
+	const ExtractionPlan::Extents &extents = plan.extents();
+	for (ExtractionPlan::Extents::const_iterator i = extents.begin(); i != extents.end(); ++ i) {
+		if (i->size > 0) map(i->index);
+	}
+}
+
+const Vpk::MMap *Vpk::ArchiveSet::archive(uint16_t index) const {
+	Archives::const_iterator i = m_archives.find(index);
+	return i == m_archives.end() ? 0 : i->second.map.get();
+}
+
+Vpk::ArchiveSet::Span Vpk::ArchiveSet::span(const File *file) const {
+	return span(file->index, file->offset, file->size);
+}
+
+Vpk::ArchiveSet::Span Vpk::ArchiveSet::span(uint16_t index, size_t offset, size_t size) const {
+	if (size == 0) return Span();
+
+	Archives::const_iterator i = m_archives.find(index);
+	if (i == m_archives.end()) {
+		throw Exception("archive is not mapped");
+	}
+
+	const Archive &archive = i->second;
+	if (!archive.map) {
+		std::rethrow_exception(archive.error);
+	}
+
+	if (offset > archive.map->size() || size > archive.map->size() - offset) {
+		throw IOError(EOF);
+	}
+
+	return Span(archive.map->data() + offset, size);
+}
+
+void Vpk::ArchiveSet::willneed(uint16_t index, size_t offset, size_t size) const {
+	const MMap *map = archive(index);
+	if (map) map->advise(offset, size, MADV_WILLNEED);
+}
@@ -0,0 +1,344 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#ifdef VPK_HAVE_IO_URING
+#	include <sys/mman.h>
+#	include <sys/syscall.h>
+#	include <sys/uio.h>
+#	include <linux/io_uring.h>
+#endif
+
+#include <vpk/async_reader.h>
+
+#ifdef VPK_HAVE_IO_URING
+// Only the few parts of liburing that are needed here, so there is no
+// additional dependency. See io_uring(7) for how the rings work.
+struct Vpk::AsyncReader::Ring {
+	Ring() : fd(-1), sqMap(MAP_FAILED), cqMap(MAP_FAILED), sqes(MAP_FAILED), unsubmitted(0) {}
+	~Ring();
+
+	bool setup(unsigned int entries);
+	struct io_uring_sqe *sqe();
+	int enter(unsigned int submit, unsigned int wait);
+
+	int                  fd;
+	void                *sqMap;
+	size_t               sqMapSize;
+	void                *cqMap;
+	size_t               cqMapSize;
+	void                *sqes;
+	size_t               sqesSize;
+
+	unsigned int        *sqTail;
+	unsigned int         sqMask;
+	unsigned int        *sqArray;
+	unsigned int        *cqHead;
+	unsigned int        *cqTail;
+	unsigned int         cqMask;
+	struct io_uring_cqe *cqes;
+
+	unsigned int         unsubmitted;
+	std::vector<struct iovec> iovecs; // one per request slot
+};
+
+bool Vpk::AsyncReader::Ring::setup(unsigned int entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (fd < 0) return false;
+
+	sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cqMapSize = params.cq_off.cqes  + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single) {
+		sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+	}
+
+	sqMap = mmap(0, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (sqMap == MAP_FAILED) return false;
+
+	if (single) {
+		cqMap = sqMap;
+	}
+	else {
+		cqMap = mmap(0, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cqMap == MAP_FAILED) return false;
+	}
+
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(0, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) return false;
+
+	char *sq = (char*) sqMap;
+	char *cq = (char*) cqMap;
+	sqTail  = (unsigned int*) (sq + params.sq_off.tail);
+	sqMask  = *(unsigned int*) (sq + params.sq_off.ring_mask);
+	sqArray = (unsigned int*) (sq + params.sq_off.array);
+	cqHead  = (unsigned int*) (cq + params.cq_off.head);
+	cqTail  = (unsigned int*) (cq + params.cq_off.tail);
+	cqMask  = *(unsigned int*) (cq + params.cq_off.ring_mask);
+	cqes    = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+	return true;
+}
+
+Vpk::AsyncReader::Ring::~Ring() {
+	if (sqes  != MAP_FAILED) munmap(sqes, sqesSize);
+	if (cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqMapSize);
+	if (sqMap != MAP_FAILED) munmap(sqMap, sqMapSize);
+	if (fd >= 0) ::close(fd);
+}
+
+// There are never more requests than submission queue entries, so there
+// always is a free one. Submission queue entry i always uses index i.
+struct io_uring_sqe *Vpk::AsyncReader::Ring::sqe() {
+	unsigned int tail  = *sqTail;
+	unsigned int index = tail & sqMask;
+	struct io_uring_sqe *entry = (struct io_uring_sqe*) sqes + index;
+	memset(entry, 0, sizeof(*entry));
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	++ unsubmitted;
+	return entry;
+}
+
+int Vpk::AsyncReader::Ring::enter(unsigned int submit, unsigned int wait) {
+	for (;;) {
+		int count = syscall(__NR_io_uring_enter, fd, submit, wait,
+			wait ? IORING_ENTER_GETEVENTS : 0, (void*) 0, 0);
+		if (count >= 0) {
+			unsubmitted -= count;
+			return count;
+		}
+		if (errno != EINTR) return -errno;
+	}
+}
+#else
+struct Vpk::AsyncReader::Ring {};
+#endif
+
+Vpk::AsyncReader::AsyncReader(unsigned int depth, Backend backend)
+		: m_depth(depth ? depth : 1), m_requests(m_depth), m_pending(0), m_ring(0) {
+	for (size_t slot = m_depth; slot > 0; -- slot) {
+		m_free.push_back(slot - 1);
+	}
+
+#ifdef VPK_HAVE_IO_URING
+	if (backend == IO_URING) {
+		Ring *ring = new Ring();
+		if (ring->setup(m_depth)) {
+			ring->iovecs.resize(m_depth);
+			m_ring = ring;
+		}
+		else {
+			delete ring;
+		}
+	}
+#else
+	(void) backend;
+#endif
+}
+
+Vpk::AsyncReader::~AsyncReader() {
+#ifdef VPK_HAVE_IO_URING
+	if (m_ring) {
+		// the kernel must not write into buffers the caller frees after this
+		while (m_free.size() < m_depth) reap();
+		delete m_ring;
+	}
+#endif
+}
+
+size_t Vpk::AsyncReader::acquire() {
+	size_t slot = m_free.back();
+	m_free.pop_back();
+	return slot;
+}
+
+void Vpk::AsyncReader::read(int fd, char *buf, size_t size, off_t offset, uint64_t tag) {
+	size_t slot = acquire();
+	Request &request = m_requests[slot];
+	request.fd     = fd;
+	request.buf    = buf;
+	request.size   = size;
+	request.offset = offset;
+	request.tag    = tag;
+	++ m_pending;
+
+	if (m_ring) {
+		push(slot);
+	}
+	else {
+		m_queued.push_back(slot);
+	}
+}
+
+bool Vpk::AsyncReader::wait(Completion &completion) {
+	if (m_pending == 0) return false;
+
+#ifdef VPK_HAVE_IO_URING
+	if (m_ring && m_ring->unsubmitted) {
+		m_ring->enter(m_ring->unsubmitted, 0);
+	}
+#endif
+
+	while (m_done.empty()) {
+		if (m_ring) {
+			reap();
+		}
+		else {
+			size_t slot = m_queued.front();
+			m_queued.pop_front();
+			readNow(slot);
+		}
+	}
+
+	completion = m_done.front();
+	m_done.pop_front();
+	-- m_pending;
+	return true;
+}
+
+void Vpk::AsyncReader::readNow(size_t slot) {
+	Request &request = m_requests[slot];
+	while (request.size > 0) {
+		ssize_t count = pread(request.fd, request.buf, request.size, request.offset);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			complete(slot, errno);
+			return;
+		}
+		else if (count == 0) {
+			complete(slot, EOF);
+			return;
+		}
+		request.buf    += count;
+		request.size   -= count;
+		request.offset += count;
+	}
+	complete(slot, 0);
+}
+
+void Vpk::AsyncReader::complete(size_t slot, int error) {
+	Completion completion = { m_requests[slot].tag, error };
+	m_done.push_back(completion);
+	release(slot);
+}
+
+#ifdef VPK_HAVE_IO_URING
+void Vpk::AsyncReader::push(size_t slot) {
+	Request &request = m_requests[slot];
+	struct io_uring_sqe *sqe = m_ring->sqe();
+	sqe->fd        = request.fd;
+	sqe->off       = request.offset;
+	sqe->user_data = slot;
+
+	// IORING_OP_READV works with every kernel that has io_uring
+	struct iovec &iov = m_ring->iovecs[slot];
+	iov.iov_base = request.buf;
+	iov.iov_len  = request.size;
+	sqe->opcode  = IORING_OP_READV;
+	sqe->addr    = (uintptr_t) &iov;
+	sqe->len     = 1;
+}
+
+void Vpk::AsyncReader::reap() {
+	Ring &ring = *m_ring;
+	bool progress = false;
+	for (;;) {
+		unsigned int head = *ring.cqHead;
+		if (head == __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+			if (progress || m_free.size() == m_depth) break;
+			int count = ring.enter(ring.unsubmitted, 1);
+			if (count < 0 && count != -EAGAIN && count != -EBUSY) {
+				// the ring is unusable, fail everything that is left
+				for (size_t slot = 0; slot < m_depth; ++ slot) {
+					if (std::find(m_free.begin(), m_free.end(), slot) != m_free.end()) continue;
+					complete(slot, -count);
+				}
+				break;
+			}
+			continue;
+		}
+
+		const struct io_uring_cqe &cqe = ring.cqes[head & ring.cqMask];
+		size_t slot = cqe.user_data;
+		int    res  = cqe.res;
+		__atomic_store_n(ring.cqHead, head + 1, __ATOMIC_RELEASE);
+
+		Request &request = m_requests[slot];
+		progress = true;
+		if (res == -EINTR || res == -EAGAIN) {
+			push(slot);
+		}
+		else if (res < 0) {
+			complete(slot, -res);
+		}
+		else if (res == 0) {
+			complete(slot, EOF);
+		}
+		else if ((size_t) res < request.size) {
+			// short read, read the rest
+			request.buf    += res;
+			request.size   -= res;
+			request.offset += res;
+			push(slot);
+		}
+		else {
+			complete(slot, 0);
+		}
+	}
+}
+#else
+void Vpk::AsyncReader::push(size_t) {}
+void Vpk::AsyncReader::reap() {}
+#endif
+
+const char *Vpk::AsyncReader::name(Backend backend) {
+	switch (backend) {
+	case IO_URING: return "io_uring";
+	case PREAD:    return "pread";
+	}
+	return "unknown";
+}
+
+bool Vpk::AsyncReader::parse(const char *name, Backend &backend) {
+	if (strcmp(name, "io_uring") == 0) {
+		backend = IO_URING;
+	}
+	else if (strcmp(name, "pread") == 0) {
+		backend = PREAD;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+bool Vpk::AsyncReader::available() {
+	AsyncReader reader(1, IO_URING);
+	return reader.backend() == IO_URING;
+}
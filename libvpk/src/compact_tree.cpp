@@ -0,0 +1,392 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <algorithm>
+#include <iostream>
+
+#include <boost/unordered_map.hpp>
+
+#include <vpk/compact_tree.h>
+#include <vpk/header.h>
+#include <vpk/mmap.h>
+#include <vpk/file_format_error.h>
+
+namespace fs = boost::filesystem;
+
+const Vpk::CompactTree::Id Vpk::CompactTree::NONE;
+
+// -1, 0 or 1 like strcmp, but the second string is not NUL terminated
+static int compare(const char *str, const char *name, size_t length) {
+	int cmp = strncmp(str, name, length);
+	if (cmp != 0) return cmp;
+	return str[length] == 0 ? 0 : 1;
+}
+
+class Vpk::CompactTree::Builder {
+public:
+	Builder(CompactTree &tree) : m_tree(tree) {}
+
+	Id mkpath(const char *path, size_t length);
+	void finish();
+
+private:
+	struct ByParentAndName {
+		ByParentAndName(const CompactTree &tree) : tree(tree) {}
+
+		bool operator () (Id lhs, Id rhs) const {
+			const DirEntry &ldir = tree.m_dirs[lhs];
+			const DirEntry &rdir = tree.m_dirs[rhs];
+			if (ldir.parent != rdir.parent) {
+				return ldir.parent < rdir.parent;
+			}
+			return strcmp(tree.m_strings.get(ldir.name), tree.m_strings.get(rdir.name)) < 0;
+		}
+
+		const CompactTree &tree;
+	};
+
+	struct ByDirAndName {
+		ByDirAndName(const CompactTree &tree) : tree(tree) {}
+
+		bool operator () (const FileEntry &lhs, const FileEntry &rhs) const {
+			if (lhs.dir != rhs.dir) {
+				return lhs.dir < rhs.dir;
+			}
+			return strcmp(tree.m_strings.get(lhs.name), tree.m_strings.get(rhs.name)) < 0;
+		}
+
+		const CompactTree &tree;
+	};
+
+	typedef boost::unordered_map<uint64_t, Id> DirMap;
+
+	CompactTree &m_tree;
+	DirMap       m_dirmap;
+};
+
+Vpk::CompactTree::Id Vpk::CompactTree::Builder::mkpath(const char *path, size_t length) {
+	const char *end = path + length;
+	const char *ptr = path;
+	Id dir = 0;
+
+	while (ptr < end) {
+		while (ptr < end && *ptr == '/') ++ ptr;
+		if (ptr == end) break;
+
+		const char *slash = (const char*) memchr(ptr, '/', end - ptr);
+		if (!slash) slash = end;
+
+		Id name = m_tree.m_strings.intern(ptr, slash - ptr);
+		uint64_t key = ((uint64_t) dir << 32) | name;
+		DirMap::const_iterator i = m_dirmap.find(key);
+		if (i != m_dirmap.end()) {
+			dir = i->second;
+		}
+		else {
+			DirEntry entry = { name, dir, NONE, 0, NONE, 0 };
+			Id id = m_tree.m_dirs.size();
+			m_tree.m_dirs.push_back(entry);
+			m_dirmap[key] = id;
+			dir = id;
+		}
+		ptr = slash;
+	}
+
+	return dir;
+}
+
+void Vpk::CompactTree::Builder::finish() {
+	std::vector<DirEntry>  &dirs  = m_tree.m_dirs;
+	std::vector<FileEntry> &files = m_tree.m_files;
+	const size_t ndirs = dirs.size();
+
+	// number dirs breadth first so that all subdirs of a dir are contiguous
+	std::vector<Id> children;
+	children.reserve(ndirs);
+	for (Id id = 1; id < ndirs; ++ id) {
+		children.push_back(id);
+	}
+	std::sort(children.begin(), children.end(), ByParentAndName(m_tree));
+
+	std::vector<uint32_t> start(ndirs + 1, 0);
+	for (std::vector<Id>::const_iterator i = children.begin(); i != children.end(); ++ i) {
+		++ start[dirs[*i].parent + 1];
+	}
+	for (size_t i = 1; i <= ndirs; ++ i) {
+		start[i] += start[i - 1];
+	}
+
+	std::vector<Id> order;
+	std::vector<Id> newid(ndirs, NONE);
+	std::vector<DirEntry> sorted;
+	order.reserve(ndirs);
+	sorted.reserve(ndirs);
+	order.push_back(0);
+	for (size_t i = 0; i < order.size(); ++ i) {
+		Id old = order[i];
+		DirEntry entry = dirs[old];
+		newid[old] = i;
+		entry.firstDir = order.size();
+		entry.dirCount = start[old + 1] - start[old];
+		order.insert(order.end(), children.begin() + start[old], children.begin() + start[old + 1]);
+		sorted.push_back(entry);
+	}
+
+	for (std::vector<DirEntry>::iterator i = sorted.begin(); i != sorted.end(); ++ i) {
+		if (i->parent != NONE) i->parent = newid[i->parent];
+	}
+	dirs.swap(sorted);
+	std::vector<DirEntry>().swap(sorted);
+
+	for (std::vector<FileEntry>::iterator i = files.begin(); i != files.end(); ++ i) {
+		i->dir = newid[i->dir];
+	}
+
+	// Names are interned, so equal names have equal ids. Like the Dir
+	// parser the entry that occurs last wins.
+	std::stable_sort(files.begin(), files.end(), ByDirAndName(m_tree));
+	m_tree.attach();
+	size_t count = 0;
+	for (size_t i = 0; i < files.size(); ++ i) {
+		if (i + 1 < files.size() &&
+			files[i].dir  == files[i + 1].dir &&
+			files[i].name == files[i + 1].name) {
+			std::cerr
+				<< "*** warning: file occured more than once: \""
+				<< m_tree.path(m_tree.file(i)) << "\"\n";
+			continue;
+		}
+		files[count ++] = files[i];
+	}
+	files.resize(count);
+
+	for (size_t i = files.size(); i > 0; -- i) {
+		DirEntry &dir = dirs[files[i - 1].dir];
+		dir.firstFile = i - 1;
+		++ dir.fileCount;
+	}
+	for (std::vector<DirEntry>::iterator i = dirs.begin(); i != dirs.end(); ++ i) {
+		if (i->fileCount == 0) i->firstFile = files.size();
+	}
+
+	dirs.shrink_to_fit();
+	files.shrink_to_fit();
+	m_tree.m_preload.shrink_to_fit();
+	m_tree.m_strings.freeze();
+	m_tree.attach();
+}
+
+void Vpk::CompactTree::read(const fs::path &path) {
+	MMap map(path);
+	MemReader io(map.begin(), map.end());
+	read(io);
+}
+
+void Vpk::CompactTree::read(MemReader &io) {
+	clear();
+
+	Header header;
+	header.read(io);
+	m_version      = header.version;
+	m_dataOffset   = header.dataOffset();
+	m_footerOffset = header.footerOffset;
+	m_footerSize   = header.footerSize;
+
+	Builder builder(*this);
+	std::vector<Id> dirfiles;
+	std::string name;
+
+	DirEntry root = { 0, NONE, NONE, 0, NONE, 0 };
+	m_dirs.push_back(root);
+
+	// types
+	for (;;) {
+		size_t typeLength = 0;
+		const char *type = io.readAsciiZ(typeLength);
+		if (typeLength == 0) break;
+
+		// dirs
+		for (;;) {
+			size_t pathLength = 0;
+			const char *path = io.readAsciiZ(pathLength);
+			if (pathLength == 0) break;
+
+			Id dir = builder.mkpath(path, pathLength);
+
+			// files
+			for (;;) {
+				size_t length = 0;
+				const char *stem = io.readAsciiZ(length);
+				if (length == 0) break;
+
+				name.assign(stem, length);
+				name += '.';
+				name.append(type, typeLength);
+
+				const char *data = io.take(18);
+				FileEntry file;
+				file.name          = m_strings.intern(name);
+				file.dir           = dir;
+				file.crc32         = MemReader::lu32(data);
+				file.preloadSize   = MemReader::lu16(data + 4);
+				file.index         = MemReader::lu16(data + 6);
+				file.offset        = MemReader::lu32(data + 8);
+				file.size          = MemReader::lu32(data + 12);
+				file.preload       = m_preload.size();
+				file.preloadOffset = 0;
+
+				if (MemReader::lu16(data + 16) != 0xFFFF) {
+					throw FileFormatError("invalid terminator");
+				}
+
+				if (file.preloadSize > 0) {
+					file.preloadOffset = io.tell();
+					const char *preload = io.take(file.preloadSize);
+					m_preload.insert(m_preload.end(), preload, preload + file.preloadSize);
+				}
+
+				if (file.index == 0x7fff) {
+					dirfiles.push_back(m_files.size());
+				}
+				m_files.push_back(file);
+			}
+		}
+	}
+
+	if (m_version == 0) {
+		m_dataOffset = io.tell();
+	}
+
+	for (std::vector<Id>::const_iterator i = dirfiles.begin(); i != dirfiles.end(); ++ i) {
+		m_files[*i].offset += m_dataOffset;
+	}
+
+	builder.finish();
+}
+
+void Vpk::CompactTree::clear() {
+	m_dirs.clear();
+	m_files.clear();
+	m_strings.clear();
+	m_preload.clear();
+	m_map.close();
+	m_version      = 0;
+	m_dataOffset   = 0;
+	m_footerOffset = 0;
+	m_footerSize   = 0;
+	attach();
+}
+
+void Vpk::CompactTree::attach() {
+	m_dirTable     = m_dirs.empty()  ? 0 : &m_dirs[0];
+	m_fileTable    = m_files.empty() ? 0 : &m_files[0];
+	m_stringTable  = m_strings.get(0);
+	m_preloadTable = m_preload.empty() ? 0 : &m_preload[0];
+	m_dirCount     = m_dirs.size();
+	m_fileCount    = m_files.size();
+	m_stringSize   = m_strings.size();
+	m_preloadSize  = m_preload.size();
+}
+
+Vpk::CompactTree::Id Vpk::CompactTree::findDir(Id parent, const char *name, size_t length) const {
+	const DirEntry &dir = m_dirTable[parent];
+	size_t lo = dir.firstDir, hi = dir.firstDir + dir.dirCount;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = compare(str(m_dirTable[mid].name), name, length);
+		if (cmp == 0) return mid;
+		if (cmp < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return NONE;
+}
+
+Vpk::CompactTree::Id Vpk::CompactTree::findFile(Id dirid, const char *name, size_t length) const {
+	const DirEntry &dir = m_dirTable[dirid];
+	size_t lo = dir.firstFile, hi = dir.firstFile + dir.fileCount;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = compare(str(m_fileTable[mid].name), name, length);
+		if (cmp == 0) return mid;
+		if (cmp < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return NONE;
+}
+
+bool Vpk::CompactTree::get(const char *path, Id &id, bool &isdir) const {
+	if (!*path || m_dirCount == 0) return false;
+
+	Id dir = 0;
+	const char *ptr = path;
+	while (*ptr == '/') ++ ptr;
+	while (*ptr) {
+		const char *slash = strchr(ptr, '/');
+		size_t length = slash ? slash - ptr : strlen(ptr);
+		const char *next = ptr + length;
+		while (*next == '/') ++ next;
+
+		if (!*next) {
+			Id file = findFile(dir, ptr, length);
+			if (file != NONE) {
+				id    = file;
+				isdir = false;
+				return true;
+			}
+		}
+
+		dir = findDir(dir, ptr, length);
+		if (dir == NONE) return false;
+		ptr = next;
+	}
+
+	id    = dir;
+	isdir = true;
+	return true;
+}
+
+std::string Vpk::CompactTree::path(const DirRef &dir) const {
+	if (dir.isroot()) return std::string();
+
+	std::vector<const char*> names;
+	for (DirRef i = dir; !i.isroot(); i = i.parent()) {
+		names.push_back(i.name());
+	}
+
+	std::string path(names.back());
+	for (std::vector<const char*>::reverse_iterator i = names.rbegin() + 1; i != names.rend(); ++ i) {
+		path += '/';
+		path += *i;
+	}
+	return path;
+}
+
+std::string Vpk::CompactTree::path(const FileRef &file) const {
+	DirRef dir = file.dir();
+	if (dir.isroot()) return file.name();
+
+	std::string path = this->path(dir);
+	path += '/';
+	path += file.name();
+	return path;
+}
+
+size_t Vpk::CompactTree::recordsMemoryUsage() const {
+	return m_dirs.capacity()  * sizeof(DirEntry) +
+	       m_files.capacity() * sizeof(FileEntry);
+}
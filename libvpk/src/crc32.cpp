@@ -0,0 +1,229 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+#include <endian.h>
+
+#include <vpk/crc32.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#	define VPK_HAVE_PCLMUL 1
+#	include <immintrin.h>
+#endif
+
+namespace {
+	// table[0] is the classic byte-at-a-time table, table[k][i] is the CRC
+	// of byte i followed by k zero bytes
+	struct Tables {
+		Tables() {
+			for (uint32_t i = 0; i < 256; ++ i) {
+				uint32_t crc = i;
+				for (int bit = 0; bit < 8; ++ bit) {
+					crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+				}
+				table[0][i] = crc;
+			}
+
+			for (uint32_t i = 0; i < 256; ++ i) {
+				for (int k = 1; k < 8; ++ k) {
+					uint32_t crc = table[k - 1][i];
+					table[k][i] = (crc >> 8) ^ table[0][crc & 0xFF];
+				}
+			}
+		}
+
+		uint32_t table[8][256];
+	};
+
+	const Tables tables;
+}
+
+static inline uint32_t lu32(const char *data) {
+	uint32_t value;
+	memcpy(&value, data, sizeof(value));
+	return le32toh(value);
+}
+
+uint32_t Vpk::Crc32::updateSlice8(uint32_t crc, const char *buffer, size_t length) {
+	const uint32_t (*table)[256] = tables.table;
+	const unsigned char *ptr = (const unsigned char*) buffer;
+
+	while (length >= 8) {
+		uint32_t one = lu32((const char*) ptr) ^ crc;
+		uint32_t two = lu32((const char*) ptr + 4);
+		crc = table[7][ one        & 0xFF] ^
+		      table[6][(one >>  8) & 0xFF] ^
+		      table[5][(one >> 16) & 0xFF] ^
+		      table[4][ one >> 24        ] ^
+		      table[3][ two        & 0xFF] ^
+		      table[2][(two >>  8) & 0xFF] ^
+		      table[1][(two >> 16) & 0xFF] ^
+		      table[0][ two >> 24        ];
+		ptr    += 8;
+		length -= 8;
+	}
+
+	while (length > 0) {
+		crc = table[0][(crc ^ *ptr) & 0xFF] ^ (crc >> 8);
+		++ ptr;
+		-- length;
+	}
+
+	return crc;
+}
+
+#ifdef VPK_HAVE_PCLMUL
+// Folds 64 bytes per iteration with carry-less multiplication and reduces
+// the result with a Barrett reduction, see Intel's "Fast CRC Computation
+// for Generic Polynomials Using PCLMULQDQ Instruction". The constants are
+// the bit-reflected ones for the CRC-32 polynomial. Needs length >= 64 and
+// a multiple of 16.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t pclmul_fold(uint32_t crc, const char *buffer, size_t length) {
+	static const uint64_t k1k2[] __attribute__((aligned(16))) = { 0x0154442bd4ULL, 0x01c6e41596ULL };
+	static const uint64_t k3k4[] __attribute__((aligned(16))) = { 0x01751997d0ULL, 0x00ccaa009eULL };
+	static const uint64_t k5k0[] __attribute__((aligned(16))) = { 0x0163cd6124ULL, 0x0000000000ULL };
+	static const uint64_t poly[] __attribute__((aligned(16))) = { 0x01db710641ULL, 0x01f7011641ULL };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128((const __m128i*) (buffer + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*) (buffer + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*) (buffer + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*) (buffer + 0x30));
+
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_load_si128((const __m128i*) k1k2);
+
+	buffer += 64;
+	length -= 64;
+
+	// fold 4x128 bits in parallel
+	while (length >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		y5 = _mm_loadu_si128((const __m128i*) (buffer + 0x00));
+		y6 = _mm_loadu_si128((const __m128i*) (buffer + 0x10));
+		y7 = _mm_loadu_si128((const __m128i*) (buffer + 0x20));
+		y8 = _mm_loadu_si128((const __m128i*) (buffer + 0x30));
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+		buffer += 64;
+		length -= 64;
+	}
+
+	// fold into 128 bits
+	x0 = _mm_load_si128((const __m128i*) k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// single folds of the remaining 128 bit blocks
+	while (length >= 16) {
+		x2 = _mm_loadu_si128((const __m128i*) buffer);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		buffer += 16;
+		length -= 16;
+	}
+
+	// fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i*) k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i*) poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (uint32_t) _mm_extract_epi32(x1, 1);
+}
+#endif
+
+bool Vpk::Crc32::hasPclmul() {
+#ifdef VPK_HAVE_PCLMUL
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#else
+	return false;
+#endif
+}
+
+uint32_t Vpk::Crc32::updatePclmul(uint32_t crc, const char *buffer, size_t length) {
+#ifdef VPK_HAVE_PCLMUL
+	// short buffers aren't worth setting up the folding
+	if (length >= 64 && hasPclmul()) {
+		size_t folded = length & ~(size_t) 15;
+		crc = pclmul_fold(crc, buffer, folded);
+		buffer += folded;
+		length -= folded;
+	}
+#endif
+	return updateSlice8(crc, buffer, length);
+}
+
+static Vpk::Crc32::Kernel select_kernel() {
+#ifdef VPK_HAVE_PCLMUL
+	if (Vpk::Crc32::hasPclmul()) {
+		return Vpk::Crc32::updatePclmul;
+	}
+#endif
+	return Vpk::Crc32::updateSlice8;
+}
+
+const Vpk::Crc32::Kernel Vpk::Crc32::s_kernel = select_kernel();
+
+const char *Vpk::Crc32::kernelName() {
+	return s_kernel == updateSlice8 ? "slice-by-8" : "pclmul";
+}
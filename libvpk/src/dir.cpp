@@ -20,6 +20,7 @@
 
 #include <vpk/dir.h>
 #include <vpk/file.h>
+#include <vpk/file_format_error.h>
 
 void Vpk::Dir::read(FileIO &io, const std::string &path, const std::string &type, std::vector<File*> &dirfiles) {
 	// files
@@ -41,7 +42,110 @@ void Vpk::Dir::read(FileIO &io, const std::string &path, const std::string &type
 	}
 }
 
+void Vpk::Dir::read(MemReader &io, const std::string &path, const std::string &type, std::vector<File*> &dirfiles) {
+	// files
+	for (;;) {
+		size_t length = 0;
+		const char *str = io.readAsciiZ(length);
+		if (length == 0) break;
+
+		std::string name;
+		name.reserve(length + 1 + type.size());
+		name.append(str, length);
+		name += ".";
+		name += type;
+		if (m_nodes.find(name) != m_nodes.end()) {
+			std::cerr
+				<< "*** warning: file occured more than once: \""
+				<< path << "/" << name << "\"\n";
+		}
+		File *file = new File(name);
+		m_nodes[name] = NodePtr(file);
+		file->read(io, dirfiles);
+	}
+}
+
+void Vpk::Dir::defer(MemReader &io, const LazyIndexPtr &index, uint32_t pathOffset, uint32_t typeOffset) {
+	LazyIndex::Block block = { typeOffset, pathOffset, (uint32_t) io.tell() };
+
+	// files, only validated and counted
+	for (;;) {
+		size_t length = 0;
+		io.readAsciiZ(length);
+		if (length == 0) break;
+
+		// crc32, preload length, index, offset, size, terminator
+		const char *entry = io.take(18);
+		if (MemReader::lu16(entry + 16) != 0xFFFF) {
+			throw FileFormatError("invalid terminator");
+		}
+		io.take(MemReader::lu16(entry + 4));
+
+		++ index->files;
+		if (MemReader::lu32(entry + 12) > 0) {
+			index->archives.insert(MemReader::lu16(entry + 6));
+		}
+	}
+
+	m_blocks.push_back(block);
+	m_index = index;
+	m_loaded.store(false, std::memory_order_release);
+}
+
+void Vpk::Dir::defer(const LazyIndexPtr &index, CompactTree::Id dir) {
+	m_treeDir = dir;
+	m_index   = index;
+	m_loaded.store(false, std::memory_order_release);
+}
+
+void Vpk::Dir::decode() const {
+	// m_index is never reset after defer(), other threads may read it
+	// here while this one decodes. The Package keeps the mapping alive
+	// anyway, so holding on to it costs nothing.
+	LazyIndex *index = m_index.get();
+	std::lock_guard<std::mutex> lock(index->mutex);
+	if (loaded()) return;
+
+	Dir *self = const_cast<Dir*>(this);
+	if (m_treeDir != CompactTree::NONE) {
+		// offsets in the tree are already absolute
+		CompactTree::DirRef ref = index->tree.dir(m_treeDir);
+		for (size_t i = 0; i < ref.files(); ++ i) {
+			CompactTree::FileRef fileref = ref.file(i);
+			File *file = new File(fileref.name(),
+				fileref.crc32(), fileref.size(), fileref.offset(), fileref.index());
+			if (fileref.preloadSize() > 0) {
+				file->preload.assign(fileref.preload(), fileref.preload() + fileref.preloadSize());
+				file->preloadOffset = fileref.preloadOffset();
+			}
+			self->m_nodes[file->name()] = NodePtr(file);
+		}
+	}
+
+	const MMap &map = index->map;
+	for (std::vector<LazyIndex::Block>::const_iterator i = m_blocks.begin(); i != m_blocks.end(); ++ i) {
+		MemReader io(map.begin(), map.end());
+		io.seek(i->files, FileIO::SET);
+
+		std::vector<File*> dirfiles;
+		self->read(io, map.data() + i->path, map.data() + i->type, dirfiles);
+
+		for (std::vector<File*>::iterator j = dirfiles.begin(); j != dirfiles.end(); ++ j) {
+			(*j)->offset += index->dataOffset;
+		}
+	}
+
+	std::vector<LazyIndex::Block>().swap(m_blocks);
+	m_loaded.store(true, std::memory_order_release);
+}
+
+Vpk::Node *Vpk::Dir::scanned(const std::string &name) {
+	Nodes::iterator i = m_nodes.find(name);
+	return i == m_nodes.end() ? 0 : i->second.get();
+}
+
 const Vpk::Node *Vpk::Dir::node(const std::string &name) const {
+	load();
 	Nodes::const_iterator i = m_nodes.find(name);
 	if (i == m_nodes.end()) {
 		return 0;
@@ -52,6 +156,7 @@ const Vpk::Node *Vpk::Dir::node(const std::string &name) const {
 }
 
 Vpk::Node *Vpk::Dir::node(const std::string &name) {
+	load();
 	Nodes::iterator i = m_nodes.find(name);
 	if (i == m_nodes.end()) {
 		return 0;
@@ -69,6 +174,7 @@ void Vpk::Dir::add(Node *node) {
 }
 
 void Vpk::Dir::remove(const std::string &name) {
+	load();
 	Nodes::iterator i = m_nodes.find(name);
 	if (i != m_nodes.end()) {
 		if (i->second->type() == DIR) {
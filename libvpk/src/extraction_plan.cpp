@@ -0,0 +1,115 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <algorithm>
+
+#include <vpk/extraction_plan.h>
+#include <vpk/dir.h>
+#include <vpk/file.h>
+
+namespace {
+	// preload only entries first, then by archive and offset
+	struct ByArchiveAndOffset {
+		bool operator () (const Vpk::ExtractionPlan::Entry &lhs, const Vpk::ExtractionPlan::Entry &rhs) const {
+			const Vpk::File *lfile = lhs.file;
+			const Vpk::File *rfile = rhs.file;
+			if ((lfile->size == 0) != (rfile->size == 0)) {
+				return lfile->size == 0;
+			}
+			if (lfile->size != 0) {
+				if (lfile->index != rfile->index) {
+					return lfile->index < rfile->index;
+				}
+				if (lfile->offset != rfile->offset) {
+					return lfile->offset < rfile->offset;
+				}
+			}
+			return lhs.path < rhs.path;
+		}
+	};
+
+	class PlanVisitor : public Vpk::Visitor {
+	public:
+		PlanVisitor(Vpk::ExtractionPlan &plan) : m_plan(plan) {}
+
+		void file(Vpk::PathRef path, const Vpk::File &file) {
+			m_plan.add(path, &file);
+		}
+
+	private:
+		Vpk::ExtractionPlan &m_plan;
+	};
+}
+
+void Vpk::ExtractionPlan::add(const Dir &dir, const std::string &prefix) {
+	PlanVisitor visitor(*this);
+	visit(dir, visitor, prefix);
+}
+
+void Vpk::ExtractionPlan::build() {
+	std::sort(m_entries.begin(), m_entries.end(), ByArchiveAndOffset());
+
+	m_extents.clear();
+	m_dirs.clear();
+	for (size_t i = 0; i < m_entries.size(); ++ i) {
+		const Entry &entry = m_entries[i];
+		const File  *file  = entry.file;
+
+		size_t slash = entry.path.rfind('/');
+		// files of a dir are usually stored together, so most of the
+		// time the dir is the same as the one of the last entry
+		if (slash != std::string::npos && slash > 0 && (m_dirs.empty() ||
+		    m_dirs.back().compare(0, std::string::npos, entry.path, 0, slash) != 0)) {
+			m_dirs.push_back(entry.path.substr(0, slash));
+		}
+
+		if (!m_extents.empty()) {
+			Extent &last = m_extents.back();
+			if (file->size == 0) {
+				if (last.size == 0) {
+					++ last.count;
+					continue;
+				}
+			}
+			else if (last.size > 0 && last.index == file->index &&
+			         (uint64_t) file->offset <= (uint64_t) last.offset + last.size) {
+				// stored back to back (or even overlapping)
+				uint64_t end = std::max(
+					(uint64_t) last.offset + last.size,
+					(uint64_t) file->offset + file->size);
+				if (end - last.offset <= m_maxExtentSize) {
+					last.size = end - last.offset;
+					++ last.count;
+					continue;
+				}
+			}
+		}
+
+		Extent extent = { file->index, file->offset, file->size, i, 1 };
+		m_extents.push_back(extent);
+	}
+
+	std::sort(m_dirs.begin(), m_dirs.end());
+	m_dirs.erase(std::unique(m_dirs.begin(), m_dirs.end()), m_dirs.end());
+}
+
+void Vpk::ExtractionPlan::clear() {
+	m_entries.clear();
+	m_extents.clear();
+	m_dirs.clear();
+}
@@ -34,6 +34,7 @@ void Vpk::File::read(FileIO &io, std::vector<File*> &dirfiles) {
 	}
 
 	if (length > 0) {
+		preloadOffset = io.tell();
 		preload.resize(length, 0);
 		io.read(&preload[0], length);
 	}
@@ -42,3 +43,27 @@ void Vpk::File::read(FileIO &io, std::vector<File*> &dirfiles) {
 		dirfiles.push_back(this);
 	}
 }
+
+void Vpk::File::read(MemReader &io, std::vector<File*> &dirfiles) {
+	// crc32, preload length, index, offset, size, terminator
+	const char *entry = io.take(18);
+	crc32 = MemReader::lu32(entry);
+	unsigned int length = MemReader::lu16(entry + 4);
+	index = MemReader::lu16(entry + 6);
+	offset = MemReader::lu32(entry + 8);
+	size = MemReader::lu32(entry + 12);
+
+	if (MemReader::lu16(entry + 16) != 0xFFFF) {
+		throw FileFormatError("invalid terminator");
+	}
+
+	if (length > 0) {
+		preloadOffset = io.tell();
+		const char *data = io.take(length);
+		preload.assign(data, data + length);
+	}
+
+	if (index == 0x7fff) {
+		dirfiles.push_back(this);
+	}
+}
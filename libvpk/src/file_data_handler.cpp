@@ -16,15 +16,200 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
 #include <vpk/file_data_handler.h>
+#include <vpk/file_data_handler_factory.h>
+#include <vpk/io_error.h>
 #include <vpk/util.h>
 
 namespace fs = boost::filesystem;
 
-Vpk::FileDataHandler::FileDataHandler(
+Vpk::FileDataHandler::FileDataHandler(int dirfd, const char *name,
 	const fs::path &path, uint32_t crc32, bool check)
 : CheckingDataHandler(path.string(), crc32), m_check(check) {
-	create_path(path.parent_path());
+	int fd;
+	{
+		Profiler::Timer timer(Profile::OPEN);
+		fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	}
+	open(fd);
+}
+
+void Vpk::FileDataHandler::open(int fd) {
+	Profiler::count(Profile::SYSCALLS);
+	if (fd < 0) throw IOError(errno);
+	Profiler::count(Profile::FILES_OPENED);
+
+	try {
+		m_io.open(fd, "wb");
+	}
+	catch (...) {
+		::close(fd);
+		throw;
+	}
+
+	// the data comes in big chunks, stdio buffering would only copy it
+	// once more
+	m_io.setnobuf();
+}
+
+void Vpk::FileDataHandler::process(const char *buffer, size_t length) {
+	if (!m_check) {
+		write(buffer, length);
+		return;
+	}
+
+	while (length > 0) {
+		size_t count = std::min(length, (size_t) WRITE_SIZE);
+		super_type::process(buffer, count);
+		write(buffer, count);
+		buffer += count;
+		length -= count;
+	}
+}
+
+void Vpk::FileDataHandler::write(const char *buffer, size_t length) {
+	Profiler::Timer timer(Profile::WRITE);
+	m_io.write(buffer, length);
+	Profiler::count(Profile::BYTES_WRITTEN, length);
+	Profiler::count(Profile::SYSCALLS);
+}
+
+size_t Vpk::FileDataHandler::copy(int fd, off_t offset, size_t length) {
+	if (m_check) return 0;
+
+	Profiler::Timer timer(Profile::WRITE);
+	size_t count = copy_range(fd, offset, m_io.fileno(), length);
+	// the kernel read the data as well
+	Profiler::count(Profile::BYTES_READ, count);
+	Profiler::count(Profile::BYTES_WRITTEN, count);
+	return count;
+}
+
+void Vpk::FileDataHandler::finish() {
+	{
+		Profiler::Timer timer(Profile::OPEN);
+		m_io.close();
+	}
+	Profiler::count(Profile::SYSCALLS);
+	if (m_check) super_type::finish();
+}
+
+Vpk::FileDataHandlerFactory::~FileDataHandlerFactory() {
+	for (Lru::const_iterator i = m_lru.begin(); i != m_lru.end(); ++ i) {
+		::close((*i)->fd);
+	}
+}
+
+Vpk::FileDataHandler *Vpk::FileDataHandlerFactory::create(const std::string &path, uint32_t crc32) {
+	size_t slash = path.rfind('/');
+	Dir *dir;
+	int fd;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		dir = &this->dir(slash == std::string::npos ? std::string() : path.substr(0, slash));
+		fd  = dir->fd;
+		// isn't closed while in use, so the fd can be used without the lock
+		++ dir->users;
+	}
+
+	const char *name = path.c_str();
+	if (slash != std::string::npos) name += slash + 1;
+
+	FileDataHandler *handler;
+	try {
+		handler = new FileDataHandler(fd, name, m_destdir / path, crc32, m_check);
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		-- dir->users;
+		throw;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	-- dir->users;
+	return handler;
+}
+
+void Vpk::FileDataHandlerFactory::mkdir(const std::string &path) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	dir(path);
+}
+
+Vpk::FileDataHandlerFactory::Dir &Vpk::FileDataHandlerFactory::dir(const std::string &path) {
+	Dirs::iterator it = m_dirs.find(path);
+	if (it != m_dirs.end()) {
+		Dir &dir = it->second;
+		if (dir.fd < 0) {
+			// was closed to make room
+			open(dir, m_root, path.c_str());
+		}
+		else {
+			m_lru.splice(m_lru.begin(), m_lru, dir.lru);
+		}
+		return dir;
+	}
+
+	if (path.empty()) {
+		create_path(m_destdir);
+		Dir &root = m_dirs[path];
+		open(root, AT_FDCWD, m_destdir.string().c_str());
+		// never closed, files are created relative to it
+		root.users = 1;
+		m_root = root.fd;
+		return root;
+	}
+
+	size_t slash = path.rfind('/');
+	Dir &parent = dir(slash == std::string::npos ? std::string() : path.substr(0, slash));
+	const char *name = path.c_str();
+	if (slash != std::string::npos) name += slash + 1;
+
+	{
+		Profiler::Timer timer(Profile::MKDIR);
+		Profiler::count(Profile::SYSCALLS);
+		if (mkdirat(parent.fd, name, 0777) == 0) {
+			Profiler::count(Profile::MKDIRS);
+		}
+		else if (errno != EEXIST) {
+			throw IOError(errno);
+		}
+	}
+
+	// keeps parent open while making room
+	++ parent.users;
+	Dir &dir = m_dirs[path];
+	try {
+		open(dir, parent.fd, name);
+	}
+	catch (...) {
+		-- parent.users;
+		m_dirs.erase(path);
+		throw;
+	}
+	-- parent.users;
+	return dir;
+}
+
+void Vpk::FileDataHandlerFactory::open(Dir &dir, int parent, const char *name) {
+	// close the least recently used directories that aren't in use
+	for (Lru::iterator i = m_lru.end(); m_lru.size() >= MAX_DIR_FDS && i != m_lru.begin();) {
+		Dir *victim = *(-- i);
+		if (victim->users == 0) {
+			::close(victim->fd);
+			victim->fd = -1;
+			i = m_lru.erase(i);
+		}
+	}
 
-	m_io.open(path, "wb");
+	dir.fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	Profiler::count(Profile::SYSCALLS);
+	if (dir.fd < 0) throw IOError(errno);
+	dir.lru = m_lru.insert(m_lru.begin(), &dir);
 }
@@ -0,0 +1,422 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <algorithm>
+
+#include <boost/format.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <vpk/index_cache.h>
+#include <vpk/crc32.h>
+#include <vpk/header.h>
+#include <vpk/mem_reader.h>
+#include <vpk/file_io.h>
+#include <vpk/io_error.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+	// Bump FORMAT whenever the cache header or the tree records change.
+	enum {
+		FORMAT          = 3,
+		BYTE_ORDER_MARK = 0x01020304,
+		ALIGNMENT       = 8,
+		// bytes at the start and end of the index, and at the end of a
+		// cache file, that are checked on every load
+		SAMPLE_SIZE     = 4096
+	};
+
+	const char MAGIC[8] = { 'V', 'P', 'K', 'I', 'N', 'D', 'E', 'X' };
+
+	struct Section {
+		uint64_t offset;
+		uint64_t count;
+	};
+
+	struct CacheHeader {
+		char     magic[8];
+		uint32_t format;
+		uint32_t byteOrder;
+		uint32_t dirEntrySize;
+		uint32_t fileEntrySize;
+
+		// key of the dir file
+		uint64_t size;
+		int64_t  mtime;
+		int64_t  mtimeNsec;
+		uint64_t inode;
+		uint32_t crc32;
+
+		uint32_t version;
+		uint32_t dataOffset;
+		uint32_t footerOffset;
+		uint32_t footerSize;
+
+		// CRC-32 of everything after the header
+		uint32_t checksum;
+		// CRC-32 of the whole index of the dir file
+		uint32_t indexChecksum;
+		// CRC-32 of the header with this field zeroed and of the last
+		// SAMPLE_SIZE bytes after it
+		uint32_t headerChecksum;
+
+		Section  dirs;
+		Section  files;
+		Section  strings;
+		Section  preload;
+	};
+}
+
+static bool section(const Section &section, size_t entrySize, size_t fileSize) {
+	return section.offset % ALIGNMENT == 0 &&
+	       section.offset <= fileSize &&
+	       section.count  <= (fileSize - section.offset) / entrySize &&
+	       section.count  <  Vpk::CompactTree::NONE;
+}
+
+static bool range(uint64_t first, uint64_t count, uint64_t size) {
+	return count == 0 || (first <= size && count <= size - first);
+}
+
+static uint64_t align(uint64_t offset) {
+	return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// keeps the last SAMPLE_SIZE bytes of what was written in tail
+static void keep(std::string &tail, const char *data, size_t size) {
+	if (size >= SAMPLE_SIZE) {
+		tail.assign(data + size - SAMPLE_SIZE, SAMPLE_SIZE);
+	}
+	else {
+		tail.append(data, size);
+		if (tail.size() > SAMPLE_SIZE) tail.erase(0, tail.size() - SAMPLE_SIZE);
+	}
+}
+
+// pads up to offset and writes a section, FileIO::write fails on size 0
+static void write(Vpk::FileIO &io, Vpk::Crc32 &crc, std::string &tail, uint64_t &pos, const Section &section, const char *data, size_t entrySize) {
+	static const char zeros[ALIGNMENT] = { 0 };
+	if (section.offset > pos) {
+		io.write(zeros, section.offset - pos);
+		crc.process_bytes(zeros, section.offset - pos);
+		keep(tail, zeros, section.offset - pos);
+	}
+
+	size_t size = section.count * entrySize;
+	if (size > 0) {
+		io.write(data, size);
+		crc.process_bytes(data, size);
+		keep(tail, data, size);
+	}
+	pos = section.offset + size;
+}
+
+static uint32_t headerChecksum(CacheHeader header, const char *tail, size_t size) {
+	header.headerChecksum = 0;
+	Vpk::Crc32 crc;
+	crc.process_bytes((const char*) &header, sizeof(header));
+	crc.process_bytes(tail, size);
+	return crc.checksum();
+}
+
+// Only the index matters for the tree. A version 0 file has no header that
+// says where the index ends, so all of it counts.
+static size_t indexSize(const Vpk::MMap &map) {
+	size_t size = map.size();
+	try {
+		Vpk::MemReader io(map.begin(), map.end());
+		Vpk::Header header;
+		header.read(io);
+		if (header.version != 0 && header.dataOffset() < size) {
+			size = header.dataOffset();
+		}
+	}
+	catch (const std::exception&) {}
+	return size;
+}
+
+// The full check of verify mode: both checksums and every file record.
+static bool verify(const CacheHeader &header, const char *data, size_t size, const Vpk::MMap &dirmap) {
+	if (Vpk::Crc32::compute(data + sizeof(header), size - sizeof(header)) != header.checksum ||
+		Vpk::Crc32::compute(dirmap.data(), indexSize(dirmap)) != header.indexChecksum) {
+		return false;
+	}
+
+	const Vpk::CompactTree::FileEntry *files = (const Vpk::CompactTree::FileEntry*) (data + header.files.offset);
+	for (uint64_t i = 0; i < header.files.count; ++ i) {
+		const Vpk::CompactTree::FileEntry &file = files[i];
+		if (file.name >= header.strings.count ||
+			file.dir  >= header.dirs.count ||
+			!range(file.preload, file.preloadSize, header.preload.count)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Vpk::IndexCache::Key::operator == (const Key &other) const {
+	return size      == other.size &&
+	       mtime     == other.mtime &&
+	       mtimeNsec == other.mtimeNsec &&
+	       inode     == other.inode &&
+	       crc32     == other.crc32;
+}
+
+Vpk::IndexCache::IndexCache() : m_dir(defaultDir()), m_verify(false) {}
+
+fs::path Vpk::IndexCache::defaultDir() {
+	const char *cache = getenv("XDG_CACHE_HOME");
+	if (cache && *cache) {
+		return fs::path(cache) / "vpk";
+	}
+
+	const char *home = getenv("HOME");
+	if (home && *home) {
+		return fs::path(home) / ".cache" / "vpk";
+	}
+
+	return fs::temp_directory_path() / "vpk-cache";
+}
+
+fs::path Vpk::IndexCache::cacheFile(const fs::path &dirfile) const {
+	fs::path abspath = fs::system_complete(dirfile);
+	uint64_t hash = boost::hash<std::string>()(abspath.string());
+	return m_dir / (boost::format("%s.%016x.idx") % abspath.filename().string() % hash).str();
+}
+
+Vpk::IndexCache::Key Vpk::IndexCache::key(const fs::path &dirfile, MMap &map) {
+	FileIO io(dirfile, "rb");
+	map.open(io.fileno());
+
+	struct stat st;
+	if (fstat(io.fileno(), &st) != 0) {
+		throw IOError(errno);
+	}
+
+	Key key;
+	key.size      = st.st_size;
+	key.mtime     = st.st_mtim.tv_sec;
+	key.mtimeNsec = st.st_mtim.tv_nsec;
+	key.inode     = st.st_ino;
+
+	// The start holds the header and the first dirs, the end the last
+	// entries. The rest is only hashed in verify mode.
+	size_t size = indexSize(map);
+	size_t head = std::min(size, (size_t) SAMPLE_SIZE);
+	size_t tail = std::min(size - head, (size_t) SAMPLE_SIZE);
+	Crc32 crc;
+	crc.process_bytes(map.data(), head);
+	crc.process_bytes(map.data() + size - tail, tail);
+	key.crc32 = crc.checksum();
+	return key;
+}
+
+bool Vpk::IndexCache::read(const fs::path &dirfile, CompactTree &tree) const {
+	MMap map;
+	Key  dirkey = key(dirfile, map);
+
+	fs::path cachefile = cacheFile(dirfile);
+	if (load(cachefile, dirkey, map, tree)) {
+		return true;
+	}
+
+	MemReader io(map.begin(), map.end());
+	tree.read(io);
+
+	try {
+		save(cachefile, dirkey, map, tree);
+	}
+	catch (const std::exception &exc) {
+		std::cerr
+			<< "*** warning: could not write index cache \""
+			<< cachefile.string() << "\": " << exc.what() << "\n";
+	}
+
+	return false;
+}
+
+bool Vpk::IndexCache::load(const fs::path &dirfile, CompactTree &tree) const {
+	MMap map;
+	Key  dirkey = key(dirfile, map);
+
+	return load(cacheFile(dirfile), dirkey, map, tree);
+}
+
+bool Vpk::IndexCache::load(const fs::path &cachefile, const Key &key, const MMap &dirmap, CompactTree &tree) const {
+	tree.clear();
+
+	try {
+		tree.m_map.open(cachefile);
+	}
+	catch (const IOError&) {
+		return false;
+	}
+
+	const char *data = tree.m_map.data();
+	size_t      size = tree.m_map.size();
+
+	if (size < sizeof(CacheHeader)) {
+		tree.clear();
+		return false;
+	}
+	size_t tail = std::min(size - sizeof(CacheHeader), (size_t) SAMPLE_SIZE);
+
+	CacheHeader header;
+	memcpy(&header, data, sizeof(header));
+
+	Key cached;
+	cached.size      = header.size;
+	cached.mtime     = header.mtime;
+	cached.mtimeNsec = header.mtimeNsec;
+	cached.inode     = header.inode;
+	cached.crc32     = header.crc32;
+
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		header.format        != FORMAT ||
+		header.byteOrder     != BYTE_ORDER_MARK ||
+		header.dirEntrySize  != sizeof(CompactTree::DirEntry) ||
+		header.fileEntrySize != sizeof(CompactTree::FileEntry) ||
+		cached != key ||
+		!section(header.dirs,    sizeof(CompactTree::DirEntry),  size) ||
+		!section(header.files,   sizeof(CompactTree::FileEntry), size) ||
+		!section(header.strings, 1, size) ||
+		!section(header.preload, 1, size) ||
+		header.dirs.count == 0 ||
+		header.strings.count == 0 ||
+		data[header.strings.offset] != 0 ||
+		data[header.strings.offset + header.strings.count - 1] != 0 ||
+		headerChecksum(header, data + size - tail, tail) != header.headerChecksum) {
+		tree.clear();
+		return false;
+	}
+
+	const CompactTree::DirEntry  *dirs  = (const CompactTree::DirEntry*)  (data + header.dirs.offset);
+	const CompactTree::FileEntry *files = (const CompactTree::FileEntry*) (data + header.files.offset);
+	const uint64_t ndirs  = header.dirs.count;
+	const uint64_t nfiles = header.files.count;
+
+	// There are few dirs and their ranges keep lookups inside the
+	// mapping, CompactTree checks the fields of the file records when they
+	// are used.
+	for (uint64_t i = 0; i < ndirs; ++ i) {
+		const CompactTree::DirEntry &dir = dirs[i];
+		if (dir.name >= header.strings.count ||
+			(i == 0 ? dir.parent != CompactTree::NONE : dir.parent >= i) ||
+			!range(dir.firstDir,  dir.dirCount,  ndirs) ||
+			!range(dir.firstFile, dir.fileCount, nfiles)) {
+			tree.clear();
+			return false;
+		}
+	}
+
+	if (m_verify && !::verify(header, data, size, dirmap)) {
+		tree.clear();
+		return false;
+	}
+
+	tree.m_dirTable     = dirs;
+	tree.m_fileTable    = files;
+	tree.m_stringTable  = data + header.strings.offset;
+	tree.m_preloadTable = data + header.preload.offset;
+	tree.m_dirCount     = ndirs;
+	tree.m_fileCount    = nfiles;
+	tree.m_stringSize   = header.strings.count;
+	tree.m_preloadSize  = header.preload.count;
+	tree.m_version      = header.version;
+	tree.m_dataOffset   = header.dataOffset;
+	tree.m_footerOffset = header.footerOffset;
+	tree.m_footerSize   = header.footerSize;
+
+	return true;
+}
+
+void Vpk::IndexCache::save(const fs::path &dirfile, const CompactTree &tree) const {
+	MMap map;
+	Key  dirkey = key(dirfile, map);
+
+	save(cacheFile(dirfile), dirkey, map, tree);
+}
+
+void Vpk::IndexCache::save(const fs::path &cachefile, const Key &key, const MMap &dirmap, const CompactTree &tree) const {
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.format        = FORMAT;
+	header.byteOrder     = BYTE_ORDER_MARK;
+	header.dirEntrySize  = sizeof(CompactTree::DirEntry);
+	header.fileEntrySize = sizeof(CompactTree::FileEntry);
+	header.size          = key.size;
+	header.mtime         = key.mtime;
+	header.mtimeNsec     = key.mtimeNsec;
+	header.inode         = key.inode;
+	header.crc32         = key.crc32;
+	header.indexChecksum = Crc32::compute(dirmap.data(), indexSize(dirmap));
+	header.version       = tree.m_version;
+	header.dataOffset    = tree.m_dataOffset;
+	header.footerOffset  = tree.m_footerOffset;
+	header.footerSize    = tree.m_footerSize;
+
+	header.dirs.offset    = align(sizeof(header));
+	header.dirs.count     = tree.m_dirCount;
+	header.files.offset   = align(header.dirs.offset + header.dirs.count * sizeof(CompactTree::DirEntry));
+	header.files.count    = tree.m_fileCount;
+	header.strings.offset = align(header.files.offset + header.files.count * sizeof(CompactTree::FileEntry));
+	header.strings.count  = tree.m_stringSize;
+	header.preload.offset = align(header.strings.offset + header.strings.count);
+	header.preload.count  = tree.m_preloadSize;
+
+	fs::create_directories(m_dir);
+
+	fs::path tmpfile(cachefile);
+	tmpfile += (boost::format(".%d.tmp") % getpid()).str();
+
+	try {
+		FileIO io(tmpfile, "wb");
+		// the header is written last, when the checksum is known
+		Crc32 crc;
+		std::string tail;
+		uint64_t pos = sizeof(header);
+		io.seek(pos, FileIO::SET);
+		write(io, crc, tail, pos, header.dirs,    (const char*) tree.m_dirTable,  sizeof(CompactTree::DirEntry));
+		write(io, crc, tail, pos, header.files,   (const char*) tree.m_fileTable, sizeof(CompactTree::FileEntry));
+		write(io, crc, tail, pos, header.strings, tree.m_stringTable,  1);
+		write(io, crc, tail, pos, header.preload, tree.m_preloadTable, 1);
+
+		header.checksum       = crc.checksum();
+		header.headerChecksum = headerChecksum(header, tail.data(), tail.size());
+		io.seek(0, FileIO::SET);
+		io.write((const char*) &header, sizeof(header));
+
+		io.close();
+		fs::rename(tmpfile, cachefile);
+	}
+	catch (...) {
+		boost::system::error_code ec;
+		fs::remove(tmpfile, ec);
+		throw;
+	}
+}
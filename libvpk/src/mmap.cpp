@@ -0,0 +1,101 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include <vpk/mmap.h>
+#include <vpk/io_error.h>
+
+bool Vpk::MMap::mappable(int fd) {
+	struct stat stbuf;
+	return fd >= 0 && fstat(fd, &stbuf) == 0 && S_ISREG(stbuf.st_mode);
+}
+
+void Vpk::MMap::open(int fd) {
+	close();
+
+	struct stat stbuf;
+	if (fstat(fd, &stbuf) != 0) {
+		throw IOError(errno);
+	}
+
+	if (!S_ISREG(stbuf.st_mode)) {
+		throw IOError(ENODEV);
+	}
+
+	// mmap() of a zero length file fails, so just keep an empty mapping
+	if (stbuf.st_size == 0) return;
+
+	void *data = mmap(NULL, stbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		throw IOError(errno);
+	}
+
+	m_data = (const char*) data;
+	m_size = stbuf.st_size;
+}
+
+void Vpk::MMap::open(const boost::filesystem::path &path) {
+	int fd = ::open(path.string().c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw IOError(errno);
+	}
+
+	try {
+		open(fd);
+	}
+	catch (...) {
+		::close(fd);
+		throw;
+	}
+
+	// the mapping stays valid after the descriptor is closed
+	::close(fd);
+}
+
+void Vpk::MMap::close() {
+	if (m_data) {
+		munmap((void*) m_data, m_size);
+		m_data = 0;
+		m_size = 0;
+	}
+}
+
+void Vpk::MMap::advise(int advice) {
+	if (m_data && madvise((void*) m_data, m_size, advice) != 0) {
+		throw IOError(errno);
+	}
+}
+
+// only the pages of the range, which is clipped to the mapping
+void Vpk::MMap::advise(size_t offset, size_t size, int advice) const {
+	if (!m_data || offset >= m_size) return;
+
+	size_t page  = sysconf(_SC_PAGESIZE);
+	size_t begin = offset / page * page;
+	size_t end   = std::min(offset + size, m_size);
+	if (madvise((void*) (m_data + begin), end - begin, advice) != 0) {
+		throw IOError(errno);
+	}
+}
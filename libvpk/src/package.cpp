@@ -19,22 +19,23 @@
 #include <map>
 #include <set>
 
-#include <boost/scoped_ptr.hpp>
-#include <boost/shared_ptr.hpp>
 #include <boost/format.hpp>
-#include <boost/algorithm/string.hpp>
 #include <boost/filesystem/operations.hpp>
 
 #include <vpk/util.h>
+#include <vpk/mmap.h>
+#include <vpk/mem_reader.h>
+#include <vpk/io_error.h>
 #include <vpk/dir.h>
 #include <vpk/file.h>
 #include <vpk/package.h>
+#include <vpk/compact_tree.h>
+#include <vpk/tree_iterator.h>
+#include <vpk/index_cache.h>
+#include <vpk/header.h>
 #include <vpk/file_format_error.h>
-#include <vpk/file_data_handler_factory.h>
-#include <vpk/checking_data_handler_factory.h>
 
-namespace fs   = boost::filesystem;
-namespace algo = boost::algorithm;
+namespace fs = boost::filesystem;
 
 void Vpk::Package::read(const fs::path &path) {
 	FileIO io(path, "rb");
@@ -42,6 +43,106 @@ void Vpk::Package::read(const fs::path &path) {
 }
 
 void Vpk::Package::read(const fs::path &path, FileIO &io) {
+	Profiler::Activation activation(m_profiler.get());
+	{
+		Profiler::Timer timer(Profile::INDEX);
+		clearIndex();
+		setPath(path);
+		read(io);
+	}
+	stats();
+}
+
+void Vpk::Package::read(const fs::path &path, const IndexCache &cache) {
+	Profiler::Activation activation(m_profiler.get());
+	{
+		Profiler::Timer timer(Profile::INDEX);
+		clearIndex();
+		setPath(path);
+
+		// On a hit the mapped tree is kept and only the dirs are built,
+		// their files are built from the records when they are accessed.
+		// In lazy mode a freshly parsed tree is kept the same way, otherwise
+		// it is turned into nodes right away and dropped.
+		LazyIndexPtr index(new LazyIndex());
+		m_lazyIndex.reset();
+		bool hit = cache.read(path, index->tree) && index->tree.mapped();
+		if (hit || m_lazy) {
+			m_lazyIndex = index;
+			defer(index);
+		}
+		else {
+			read(index->tree);
+		}
+	}
+	stats();
+}
+
+void Vpk::Package::setStatsHandler(StatsHandler *handler) {
+	m_statsHandler = handler;
+	m_profiler.reset(handler ? new Profiler() : 0);
+}
+
+static void add(Vpk::Dir &dir, const Vpk::CompactTree::DirRef &ref) {
+	for (size_t i = 0; i < ref.subdirs(); ++ i) {
+		Vpk::CompactTree::DirRef subref = ref.subdir(i);
+		Vpk::Dir *subdir = new Vpk::Dir(subref.name());
+		dir.add(subdir);
+		add(*subdir, subref);
+	}
+
+	for (size_t i = 0; i < ref.files(); ++ i) {
+		Vpk::CompactTree::FileRef fileref = ref.file(i);
+		Vpk::File *file = new Vpk::File(fileref.name(),
+			fileref.crc32(), fileref.size(), fileref.offset(), fileref.index());
+		if (fileref.preloadSize() > 0) {
+			file->preload.assign(fileref.preload(), fileref.preload() + fileref.preloadSize());
+			file->preloadOffset = fileref.preloadOffset();
+		}
+		dir.add(file);
+	}
+}
+
+static void defer(Vpk::Dir &dir, const Vpk::CompactTree::DirRef &ref, const Vpk::LazyIndexPtr &index) {
+	for (size_t i = 0; i < ref.subdirs(); ++ i) {
+		Vpk::CompactTree::DirRef subref = ref.subdir(i);
+		Vpk::Dir *subdir = new Vpk::Dir(subref.name());
+		dir.add(subdir);
+		++ index->dirs;
+		defer(*subdir, subref, index);
+	}
+
+	if (ref.files() > 0) {
+		dir.defer(index, ref.id());
+		index->files += ref.files();
+		for (size_t i = 0; i < ref.files(); ++ i) {
+			Vpk::CompactTree::FileRef fileref = ref.file(i);
+			if (fileref.size() > 0) index->archives.insert(fileref.index());
+		}
+	}
+}
+
+void Vpk::Package::defer(const LazyIndexPtr &index) {
+	const CompactTree &tree = index->tree;
+	m_version      = tree.version();
+	m_dataOffset   = tree.dataoff();
+	m_footerOffset = tree.footerOffset();
+	m_footerSize   = tree.footerSize();
+
+	::defer(*this, tree.root(), index);
+}
+
+void Vpk::Package::read(const CompactTree &tree) {
+	m_version      = tree.version();
+	m_dataOffset   = tree.dataoff();
+	m_footerOffset = tree.footerOffset();
+	m_footerSize   = tree.footerSize();
+
+	// offsets of files in the dir file are already absolute
+	::add(*this, tree.root());
+}
+
+void Vpk::Package::setPath(const fs::path &path) {
 	fs::path abspath = fs::system_complete(path);
 	m_dirfile = abspath.filename().string();
 		
@@ -57,55 +158,92 @@ void Vpk::Package::read(const fs::path &path, FileIO &io) {
 		setName(m_dirfile.substr(0, m_dirfile.size()-8));
 	}
 	m_srcdir = abspath.parent_path().string();
-	
-	read(io);
 }
 
 void Vpk::Package::read(FileIO &io) {
-	size_t headerSize = 0;
-	unsigned int indexSize = 0;
+	// Parsing the index through stdio costs a function call per byte, so
+	// map the whole file and decode it in place when possible. Non-seekable
+	// input (pipes etc.) can't be mapped and is read through FileIO.
+	//
+	// A lazily read package keeps the mapping, see LazyIndex.
+	int fd = io.fileno();
+	m_lazyIndex.reset();
+	if (MMap::mappable(fd)) {
+		MMap map;
+		try {
+			if (m_lazy) {
+				m_lazyIndex.reset(new LazyIndex(fd));
+			}
+			else {
+				map.open(fd);
+			}
+		}
+		catch (const IOError&) {
+			readIndex(io);
+			return;
+		}
 
-	m_version      = 0;
-	m_dataOffset   = 0;
-	m_footerOffset = 0;
-	m_footerSize   = 0;
+		const MMap &mapped = m_lazyIndex ? m_lazyIndex->map : map;
+		MemReader reader(mapped.begin(), mapped.end());
+		reader.seek(io.tell(), FileIO::SET);
+		readIndex(reader);
 
-	if (io.readLU32() != 0x55AA1234) {
-		io.seek(-4, FileIO::CUR);
+		if (m_lazyIndex) {
+			m_lazyIndex->dataOffset = m_dataOffset;
+		}
+
+		// leave io at the end of the index like the FileIO parser would
+		io.seek(reader.tell(), FileIO::SET);
 	}
 	else {
-		m_version    = io.readLU32();
-		indexSize    = io.readLU32();
-		headerSize   = io.tell();
-		m_dataOffset = indexSize + headerSize; // + footerSize?
-
-		if (m_version == 2) {
-			m_footerOffset = io.readLU32();
-			io.readLU32(); // UNKNOWN
-			m_footerSize = io.readLU32();
-			io.readLU32(); // UNKNOWN
-		}
-		else if (m_version != 1) {
-			throw FileFormatError((boost::format("unsupported VPK version: %u")
-				% m_version).str());
-		}
+		readIndex(io);
+	}
+}
+
+// FileIO can't be read lazily, the Package only uses MemReader for that
+static void readFiles(Vpk::Dir &dir, Vpk::FileIO &io, const std::string &path, const std::string &type,
+                      uint32_t, uint32_t, std::vector<Vpk::File*> &dirfiles, const Vpk::LazyIndexPtr&) {
+	dir.read(io, path, type, dirfiles);
+}
+
+static void readFiles(Vpk::Dir &dir, Vpk::MemReader &io, const std::string &path, const std::string &type,
+                      uint32_t pathOffset, uint32_t typeOffset, std::vector<Vpk::File*> &dirfiles,
+                      const Vpk::LazyIndexPtr &lazyIndex) {
+	if (lazyIndex) {
+		dir.defer(io, lazyIndex, pathOffset, typeOffset);
 	}
+	else {
+		dir.read(io, path, type, dirfiles);
+	}
+}
+
+template<typename Reader>
+void Vpk::Package::readIndex(Reader &io) {
+	Header header;
+	header.read(io);
+
+	m_version      = header.version;
+	m_dataOffset   = header.dataOffset();
+	m_footerOffset = header.footerOffset;
+	m_footerSize   = header.footerSize;
 
 	std::vector<File*> dirfiles;
 
 	// types
 	for (;;) {
+		uint32_t typeOffset = m_lazyIndex ? io.tell() : 0;
 		std::string type;
 		io.readAsciiZ(type);
 		if (type.empty()) break;
 		
 		// dirs
 		for (;;) {
+			uint32_t pathOffset = m_lazyIndex ? io.tell() : 0;
 			std::string path;
 			io.readAsciiZ(path);
 			if (path.empty()) break;
 
-			mkpath(path).read(io, path, type, dirfiles);
+			readFiles(mkpath(path), io, path, type, pathOffset, typeOffset, dirfiles, m_lazyIndex);
 		}
 	}
 
@@ -115,7 +253,7 @@ void Vpk::Package::read(FileIO &io) {
 	else if (m_version == 1 && io.tell() != m_dataOffset) {
 		Exception exc(
 			(boost::format("missmatch between header index size (%u) and real index size (%u)")
-			% indexSize % (io.tell() - headerSize)).str());
+			% header.indexSize % (io.tell() - header.headerSize)).str());
 		if (archiveerror(exc, (fs::path(m_srcdir) / (name() + "_dir.vpk")).string())) {
 			throw exc;
 		}
@@ -137,10 +275,11 @@ Vpk::Dir &Vpk::Package::mkpath(const char *path) {
 	while (*ptr) {
 		const char *slash = strchr(ptr, '/');
 		if (!slash) {
-			Node *node = dir->node(ptr);
+			Node *node = m_lazyIndex ? dir->scanned(ptr) : dir->node(ptr);
 			if (!node) {
 				Dir *newdir = new Dir(ptr);
 				dir->add(newdir);
+				if (m_lazyIndex) ++ m_lazyIndex->dirs;
 				dir = newdir;
 			}
 			else if (node->type() != Node::DIR) {
@@ -154,10 +293,11 @@ Vpk::Dir &Vpk::Package::mkpath(const char *path) {
 		}
 		else {
 			std::string name(ptr, slash - ptr);
-			Node *node = dir->node(name);
+			Node *node = m_lazyIndex ? dir->scanned(name) : dir->node(name);
 			if (!node) {
 				Dir *newdir = new Dir(name);
 				dir->add(newdir);
+				if (m_lazyIndex) ++ m_lazyIndex->dirs;
 				dir = newdir;
 			}
 			else if (node->type() != Node::DIR) {
@@ -182,6 +322,14 @@ Vpk::Node *Vpk::Package::get(const char *path) {
 	Dir  *dir  = this;
 	const char *ptr = path;
 	while (*ptr == '/') ++ ptr;
+
+	if (m_indexed && *ptr) {
+		size_t length = strlen(ptr);
+		if (PathIndex::normalized(ptr, length)) {
+			return m_index.get(ptr, length);
+		}
+	}
+
 	while (*ptr) {
 		const char *slash = strchr(ptr, '/');
 		if (!slash) {
@@ -207,25 +355,15 @@ Vpk::Node *Vpk::Package::get(const char *path) {
 	return node;
 }
 
-static size_t filecount(const Vpk::Nodes &nodes) {
+size_t Vpk::Package::filecount() const {
 	size_t n = 0;
-	for (Vpk::Nodes::const_iterator it = nodes.begin(); it != nodes.end(); ++ it) {
-		Vpk::Node *node = it->second.get();
-		if (node->type() == Vpk::Node::DIR) {
-			n += filecount(((const Vpk::Dir*) node)->nodes());
-		}
-		else {
-			++ n;
-		}
+	for (TreeIterator it(*this); it.next();) {
+		if (it.step() == TreeIterator::FILE) ++ n;
 	}
 
 	return n;
 }
 
-size_t Vpk::Package::filecount() const {
-	return ::filecount(nodes());
-}
-
 void Vpk::Package::filter(Dir &dir, const std::set<Node*> &keep) {
 	std::vector<std::string> erase;
 	for (Nodes::iterator it = dir.begin(); it != dir.end(); ++ it) {
@@ -269,6 +407,10 @@ void Vpk::Package::filter(const std::vector<std::string> &paths) {
 	}
 
 	filter(*this, keep);
+
+	if (m_indexed) {
+		buildIndex();
+	}
 }
 
 bool Vpk::Package::error(const std::string &msg, const std::string &path, ErrorMethod handler) const {
@@ -296,130 +438,3 @@ std::string Vpk::Package::archiveName(uint16_t index) const {
 boost::filesystem::path Vpk::Package::archivePath(uint16_t index) const {
 	return fs::path(m_srcdir) / archiveName(index);
 }
-
-void Vpk::Package::extract(const std::string &destdir, bool check) const {
-	FileDataHandlerFactory factory(destdir, check);
-	process(factory);
-}
-
-void Vpk::Package::check() const {
-	CheckingDataHandlerFactory factory;
-	process(factory);
-}
-
-void Vpk::Package::process(const Nodes &nodes,
-                           const std::vector<std::string> &prefix,
-                           Archives &archives,
-                           DataHandlerFactory &factory) const {
-	for (Nodes::const_iterator it = nodes.begin(); it != nodes.end(); ++ it) {
-		const Node *node = it->second.get();
-		std::vector<std::string> pathvec(prefix);
-		pathvec.push_back(node->name());
-		if (node->type() == Node::DIR) {
-			process(((const Dir*) node)->nodes(), pathvec, archives, factory);
-		}
-		else {
-			const File *file = (const File*) node;
-			std::string path = algo::join(pathvec, "/");
-
-			if (m_handler) m_handler->extract(path);
-			boost::scoped_ptr<DataHandler> dataHandler;
-				
-			try {
-				dataHandler.reset(factory.create(path, file->crc32));
-			}
-			catch (const std::exception &exc) {
-				if (fileerror(exc, path)) throw;
-				continue;
-			}
-	
-			size_t preloadSize = file->preload.size();
-			if (preloadSize > 0) {
-				try {
-					dataHandler->process((char*) &file->preload[0], preloadSize);
-				}
-				catch (const std::exception &exc) {
-					if (fileerror(exc, path)) throw;
-					continue;
-				}
-			}
-
-			boost::shared_ptr<FileIO> archive;
-			
-			Archives::iterator i = archives.find(file->index);
-			if (i != archives.end()) {
-				archive = i->second;
-				if (!archive) {
-					Exception exc("archive does not exist");
-					if (archiveerror(exc, this->archivePath(file->index).string())) {
-						throw exc;
-					}
-					continue;
-				}
-			}
-			else {
-				fs::path archivePath(this->archivePath(file->index));
-				if (!fs::exists(archivePath)) {
-					Exception exc("archive does not exist");
-					if (archiveerror(exc, archivePath.string())) {
-						throw exc;
-					}
-
-					archives[file->index] = boost::shared_ptr<FileIO>();
-					continue;
-				}
-				archive.reset(new FileIO(archivePath));
-				archives[file->index] = archive;
-			}
-
-			archive->seek(file->offset, FileIO::SET);
-			char data[BUFSIZ];
-			size_t left = file->size;
-			bool fail = false;
-			while (left > 0) {
-				size_t count = std::min(left, (size_t)BUFSIZ);
-				try {
-					archive->read(data, count);
-				}
-				catch (const std::exception& exc) {
-					if (archiveerror(exc, archivePath(file->index).string())) throw;
-					fail = true;
-					break;
-				}
-
-				try {
-					dataHandler->process(data, count);
-				}
-				catch (const std::exception& exc) {
-					if (fileerror(exc, path)) throw;
-					fail = true;
-					break;
-				}
-
-				left -= count;
-			}
-
-			if (fail) continue;
-				
-			try {
-				dataHandler->finish();
-			}
-			catch (const std::exception& exc) {
-				if (fileerror(exc, path)) throw;
-				continue;
-			}
-			
-			if (m_handler) m_handler->success(path);
-		}
-	}
-}
-
-void Vpk::Package::process(DataHandlerFactory &factory) const {
-	Archives archives;
-
-	if (m_handler) m_handler->begin(*this);
-
-	process(nodes(), std::vector<std::string>(), archives, factory);
-
-	if (m_handler) m_handler->end();
-}
@@ -0,0 +1,125 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <boost/functional/hash.hpp>
+
+#include <vpk/path_index.h>
+#include <vpk/dir.h>
+
+static size_t count(const Vpk::Dir &dir) {
+	size_t n = 0;
+	for (Vpk::Dir::const_iterator it = dir.begin(); it != dir.end(); ++ it) {
+		const Vpk::Node *node = it->second.get();
+		++ n;
+		if (node->type() == Vpk::Node::DIR) {
+			n += count(*(const Vpk::Dir*) node);
+		}
+	}
+	return n;
+}
+
+uint32_t Vpk::PathIndex::hash(const char *path, size_t length) {
+	return (uint32_t) boost::hash_range(path, path + length);
+}
+
+bool Vpk::PathIndex::normalized(const char *path, size_t length) {
+	if (length == 0 || path[0] == '/' || path[length - 1] == '/') {
+		return false;
+	}
+
+	for (const char *slash = (const char*) memchr(path, '/', length); slash;
+		slash = (const char*) memchr(slash + 1, '/', length - (slash + 1 - path))) {
+		if (slash[1] == '/') return false;
+	}
+
+	return true;
+}
+
+void Vpk::PathIndex::build(Dir &root) {
+	clear();
+
+	// keep the load factor at or below 1/2
+	size_t nodes = count(root);
+	size_t capacity = 16;
+	while (capacity < nodes * 2) capacity <<= 1;
+	m_slots.resize(capacity);
+
+	std::string path;
+	build(root, path);
+	m_keys.shrink_to_fit();
+}
+
+void Vpk::PathIndex::build(Dir &dir, std::string &path) {
+	size_t length = path.size();
+	for (Dir::iterator it = dir.begin(); it != dir.end(); ++ it) {
+		Node *node = it->second.get();
+		if (length > 0) path += '/';
+		path += node->name();
+		insert(path, node);
+		if (node->type() == Node::DIR) {
+			build(*(Dir*) node, path);
+		}
+		path.resize(length);
+	}
+}
+
+void Vpk::PathIndex::insert(const std::string &path, Node *node) {
+	uint32_t h    = hash(path.c_str(), path.size());
+	size_t   mask = m_slots.size() - 1;
+
+	for (size_t i = h & mask;; i = (i + 1) & mask) {
+		Slot &slot = m_slots[i];
+		if (!slot.node) {
+			slot.node   = node;
+			slot.hash   = h;
+			slot.key    = m_keys.size();
+			slot.length = path.size();
+			m_keys.insert(m_keys.end(), path.begin(), path.end());
+			++ m_size;
+			break;
+		}
+	}
+}
+
+Vpk::Node *Vpk::PathIndex::get(const char *path, size_t length) const {
+	if (m_slots.empty()) return 0;
+
+	uint32_t h    = hash(path, length);
+	size_t   mask = m_slots.size() - 1;
+
+	for (size_t i = h & mask;; i = (i + 1) & mask) {
+		const Slot &slot = m_slots[i];
+		if (!slot.node) {
+			return 0;
+		}
+		else if (slot.hash == h && slot.length == length &&
+			memcmp(&m_keys[slot.key], path, length) == 0) {
+			return slot.node;
+		}
+	}
+}
+
+void Vpk::PathIndex::clear() {
+	std::vector<Slot>().swap(m_slots);
+	std::vector<char>().swap(m_keys);
+	m_size = 0;
+}
+
+size_t Vpk::PathIndex::memoryUsage() const {
+	return m_slots.capacity() * sizeof(Slot) + m_keys.capacity();
+}
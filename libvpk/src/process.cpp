@@ -0,0 +1,864 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <new>
+#include <thread>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/filesystem/operations.hpp>
+
+#include <vpk/dir.h>
+#include <vpk/file.h>
+#include <vpk/package.h>
+#include <vpk/io_error.h>
+#include <vpk/async_reader.h>
+#include <vpk/archive_set.h>
+#include <vpk/file_data_handler_factory.h>
+#include <vpk/checking_data_handler_factory.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+	enum Status {
+		PENDING,
+		SUCCESS,
+		FILE_ERROR,
+		ARCHIVE_ERROR
+	};
+
+	struct Result {
+		Result() : status(PENDING) {}
+
+		Status             status;
+		std::exception_ptr error;
+	};
+
+	struct Archive {
+		Archive() : fd(-1) {}
+
+		int                fd;
+		std::exception_ptr error;
+	};
+
+	// Opens every archive used by the plan once. The table is read only
+	// afterwards and all reads use pread(), which doesn't touch the file
+	// position, so it can be shared by all threads.
+	class ArchiveFds {
+	public:
+		ArchiveFds(const Vpk::Package &package, const Vpk::ExtractionPlan &plan);
+		~ArchiveFds();
+
+		const Archive &get(uint16_t index) const { return m_archives.find(index)->second; }
+
+	private:
+		std::map<uint16_t, Archive> m_archives;
+	};
+
+	// Page aligned buffer that grows in whole MiBs. Data read into it
+	// doesn't straddle more pages than necessary and big writes from it
+	// don't have to be split up by the kernel.
+	class Buffer {
+	public:
+		enum {
+			ALIGNMENT   = 4096,
+			GRANULARITY = 1024 * 1024
+		};
+
+		Buffer() : m_data(0), m_size(0) {}
+		~Buffer() { free(m_data); }
+
+		char  *data() { return m_data; }
+		size_t size() const { return m_size; }
+
+		// makes room for at least size bytes, the contents are lost
+		void reserve(size_t size);
+
+	private:
+		Buffer(const Buffer&);
+		Buffer &operator = (const Buffer&);
+
+		char  *m_data;
+		size_t m_size;
+	};
+
+	// A contiguous range of extents owned by one worker thread. The owner
+	// takes extents from the front, idle workers steal the back half.
+	struct Queue {
+		Queue() : begin(0), end(0) {}
+
+		std::mutex mutex;
+		size_t     begin;
+		size_t     end;
+	};
+
+	class Executor {
+	public:
+		typedef Vpk::ExtractionPlan::Entry  Entry;
+		typedef Vpk::ExtractionPlan::Extent Extent;
+
+		// With mapped archives extents are processed straight from the
+		// mappings and nothing is read.
+		Executor(const Vpk::Package &package,
+		         const Vpk::ExtractionPlan &plan,
+		         Vpk::DataHandlerFactory &factory,
+		         const Vpk::ArchiveSet *mapped = 0);
+
+		// splits the extents into one queue per worker so that every
+		// queue holds about the same number of bytes
+		void partition(size_t workers);
+
+		// worker thread main loop: processes extents until there are none
+		// left. An exception stops all workers and is kept for error().
+		void run(size_t worker);
+		void abort() { m_abort = true; }
+
+		// the first exception a worker failed with, if any
+		std::exception_ptr error();
+
+		// reads one extent and feeds its entries to their data handlers
+		void process(const Extent &extent, const ArchiveFds &archives, Buffer &buffer);
+
+		// feeds the entries of an extent that was read into data to their
+		// data handlers
+		void process(const Extent &extent, const char *data);
+
+		// feeds the entries of an extent from the mapped archives
+		void process(const Extent &extent);
+
+		// reports the same error for all entries of an extent
+		void fail(const Extent &extent, Status status, std::exception_ptr error);
+
+		// blocks until the result of the given entry is available or a
+		// worker failed, the result is still PENDING then
+		const Result &wait(size_t entry);
+		bool done(size_t entry);
+
+		const Vpk::ExtractionPlan &plan() const { return m_plan; }
+
+		// the data handlers copy the data themselves, see DataHandler::copy()
+		bool zeroCopy() const { return m_zeroCopy; }
+
+	private:
+		// Takes the next extent for the worker, false if there is none
+		// left to take. A queue only ever gets extents stolen from a
+		// queue that had at least two, so once no queue has two left the
+		// worker can exit: the remaining extents are in flight or next
+		// in line for their owners, who are still running.
+		bool next(size_t worker, size_t &extent);
+		// false if no other queue has two extents left
+		bool steal(size_t worker, size_t &extent);
+		void work(size_t worker);
+		uint64_t bytes(size_t begin, size_t end) const { return m_bytes[end] - m_bytes[begin]; }
+		// the first index after begin where the extents from begin on hold
+		// at least share bytes, clamped to [lo, hi]
+		size_t boundary(size_t begin, size_t end, uint64_t share, size_t lo, size_t hi) const;
+		// splits [begin, end) in two non-empty halves of about the same
+		// number of bytes, needs at least two extents
+		size_t split(size_t begin, size_t end) const;
+
+		Status process(const Entry &entry, const char *data, size_t size, std::exception_ptr &error);
+		Status stream(const Entry &entry, int fd, Buffer &buffer, std::exception_ptr &error);
+		void finish(size_t entry, Status status, std::exception_ptr error);
+
+		const Vpk::Package        &m_package;
+		const Vpk::ExtractionPlan &m_plan;
+		Vpk::DataHandlerFactory   &m_factory;
+		const Vpk::ArchiveSet     *m_mapped;
+		std::vector<Result>        m_results;
+		std::vector<uint64_t>      m_bytes; // m_bytes[i]: bytes in extents [0, i)
+		std::vector<Queue>         m_queues;
+		std::atomic<bool>          m_abort;
+		bool                       m_zeroCopy;
+		std::mutex                 m_mutex;
+		std::condition_variable    m_done;
+		std::exception_ptr         m_error;
+	};
+
+	// The archive reads of one thread. Up to the read depth of the package
+	// extents are read ahead while the data of earlier ones is processed.
+	// Extents that need no read or are too big to be held in memory are
+	// processed synchronously by push().
+	class Pipeline {
+	public:
+		Pipeline(Executor &executor, const ArchiveFds &archives,
+		         unsigned int depth, Vpk::AsyncReader::Backend backend);
+
+		bool full()  const { return m_free.empty(); }
+		bool empty() const { return m_reader.pending() == 0; }
+
+		void push(size_t extent);
+
+		// waits for one read and processes its extent
+		void pop();
+
+	private:
+		struct Slot {
+			size_t            extent;
+			Buffer buffer;
+		};
+
+		Executor               &m_executor;
+		const ArchiveFds       &m_archives;
+		std::vector<Slot>       m_slots;
+		std::vector<size_t>     m_free;
+		Buffer                  m_buffer; // for synchronous reads
+		// declared last so it is destroyed first, in flight reads still
+		// write into the slot buffers
+		Vpk::AsyncReader        m_reader;
+	};
+
+	// joins all threads even when the calling thread throws
+	class Threads {
+	public:
+		Threads(Executor &executor) : m_executor(executor) {}
+		~Threads() { join(); }
+
+		void start(size_t count) {
+			m_executor.partition(count);
+			for (size_t i = 0; i < count; ++ i) {
+				m_threads.push_back(std::thread(&Executor::run, &m_executor, i));
+			}
+		}
+
+		void join() {
+			m_executor.abort();
+			for (std::vector<std::thread>::iterator i = m_threads.begin(); i != m_threads.end(); ++ i) {
+				if (i->joinable()) i->join();
+			}
+		}
+
+	private:
+		Executor                &m_executor;
+		std::vector<std::thread> m_threads;
+	};
+}
+
+// reads exactly size bytes at offset
+static void pread_all(int fd, char *buf, size_t size, off_t offset) {
+	while (size > 0) {
+		ssize_t count = pread(fd, buf, size, offset);
+		Vpk::Profiler::count(Vpk::Profile::SYSCALLS);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			throw Vpk::IOError(errno);
+		}
+		else if (count == 0) {
+			throw Vpk::IOError(EOF);
+		}
+		Vpk::Profiler::count(Vpk::Profile::BYTES_READ, count);
+		buf    += count;
+		size   -= count;
+		offset += count;
+	}
+}
+
+void Buffer::reserve(size_t size) {
+	if (size <= m_size) return;
+
+	size = (size + GRANULARITY - 1) / GRANULARITY * GRANULARITY;
+	void *data = 0;
+	if (posix_memalign(&data, ALIGNMENT, size) != 0) {
+		throw std::bad_alloc();
+	}
+	free(m_data);
+	m_data = (char*) data;
+	m_size = size;
+}
+
+ArchiveFds::ArchiveFds(const Vpk::Package &package, const Vpk::ExtractionPlan &plan) {
+	const Vpk::ExtractionPlan::Extents &extents = plan.extents();
+	for (Vpk::ExtractionPlan::Extents::const_iterator i = extents.begin(); i != extents.end(); ++ i) {
+		if (i->size == 0 || m_archives.find(i->index) != m_archives.end()) continue;
+
+		Archive &archive = m_archives[i->index];
+		fs::path archivePath(package.archivePath(i->index));
+		if (!fs::exists(archivePath)) {
+			archive.error = std::make_exception_ptr(Vpk::Exception("archive does not exist"));
+		}
+		else {
+			archive.fd = ::open(archivePath.string().c_str(), O_RDONLY);
+			if (archive.fd < 0) {
+				archive.error = std::make_exception_ptr(Vpk::IOError(errno));
+			}
+		}
+	}
+}
+
+ArchiveFds::~ArchiveFds() {
+	for (std::map<uint16_t, Archive>::iterator i = m_archives.begin(); i != m_archives.end(); ++ i) {
+		if (i->second.fd >= 0) ::close(i->second.fd);
+	}
+}
+
+Executor::Executor(
+	const Vpk::Package &package,
+	const Vpk::ExtractionPlan &plan,
+	Vpk::DataHandlerFactory &factory,
+	const Vpk::ArchiveSet *mapped)
+: m_package(package), m_plan(plan), m_factory(factory), m_mapped(mapped),
+  m_results(plan.entries().size()), m_abort(false), m_zeroCopy(factory.zeroCopy()) {
+	const Vpk::ExtractionPlan::Entries &entries = plan.entries();
+	const Vpk::ExtractionPlan::Extents &extents = plan.extents();
+
+	// preload data costs about as much to check or write as archive data
+	m_bytes.reserve(extents.size() + 1);
+	m_bytes.push_back(0);
+	for (Vpk::ExtractionPlan::Extents::const_iterator i = extents.begin(); i != extents.end(); ++ i) {
+		uint64_t size = i->size;
+		for (size_t j = i->first; j < i->first + i->count; ++ j) {
+			size += entries[j].file->preload.size();
+		}
+		m_bytes.push_back(m_bytes.back() + size);
+	}
+}
+
+size_t Executor::boundary(size_t begin, size_t end, uint64_t share, size_t lo, size_t hi) const {
+	size_t index = std::lower_bound(m_bytes.begin() + begin, m_bytes.begin() + end, m_bytes[begin] + share) - m_bytes.begin();
+	return std::min(std::max(index, lo), hi);
+}
+
+size_t Executor::split(size_t begin, size_t end) const {
+	// a big last extent would otherwise leave nothing for the second half
+	return boundary(begin, end, bytes(begin, end) / 2, begin + 1, end - 1);
+}
+
+void Executor::partition(size_t workers) {
+	std::vector<Queue>(workers).swap(m_queues);
+
+	size_t begin = 0;
+	size_t end   = m_plan.extents().size();
+	for (size_t i = 0; i < workers; ++ i) {
+		Queue &queue = m_queues[i];
+		queue.begin = begin;
+		if (i + 1 == workers) {
+			queue.end = end;
+		}
+		else {
+			// leave at least one extent for each of the other workers as
+			// long as there are enough
+			size_t rest = workers - i - 1;
+			queue.end = end - begin > rest ?
+				boundary(begin, end, bytes(begin, end) / (workers - i), begin + 1, end - rest) :
+				std::min(begin + 1, end);
+		}
+		begin = queue.end;
+	}
+}
+
+void Executor::run(size_t worker) {
+	try {
+		work(worker);
+	}
+	catch (...) {
+		// e.g. bad_alloc or an error of a data handler factory, nothing
+		// a single file can be blamed for
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_error) m_error = std::current_exception();
+		m_abort = true;
+		m_done.notify_all();
+	}
+}
+
+std::exception_ptr Executor::error() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_error;
+}
+
+void Executor::work(size_t worker) {
+	Vpk::Profiler::Activation activation(m_package.profiler());
+	size_t index;
+
+	if (m_mapped) {
+		while (!m_abort && next(worker, index)) {
+			process(m_plan.extents()[index]);
+		}
+		return;
+	}
+
+	// Each worker opens the archives itself. Threads sharing one struct
+	// file would contend on its reference count on every pread().
+	ArchiveFds archives(m_package, m_plan);
+	Pipeline pipeline(*this, archives, m_package.readDepth(), m_package.readBackend());
+
+	while (!m_abort) {
+		while (!pipeline.full() && next(worker, index)) {
+			pipeline.push(index);
+		}
+		if (pipeline.empty()) break;
+		pipeline.pop();
+	}
+}
+
+bool Executor::next(size_t worker, size_t &extent) {
+	{
+		Queue &queue = m_queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.begin < queue.end) {
+			extent = queue.begin ++;
+			return true;
+		}
+	}
+
+	return !m_abort && steal(worker, extent);
+}
+
+bool Executor::steal(size_t worker, size_t &extent) {
+	for (;;) {
+		// the victim is the queue with the most bytes left
+		size_t   victim = worker;
+		uint64_t most   = 0;
+		for (size_t i = 0; i < m_queues.size(); ++ i) {
+			if (i == worker) continue;
+			Queue &queue = m_queues[i];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			// a single extent is left to its owner
+			if (queue.begin + 2 <= queue.end && bytes(queue.begin, queue.end) >= most) {
+				most   = bytes(queue.begin, queue.end);
+				victim = i;
+			}
+		}
+
+		if (victim == worker) return false;
+
+		size_t begin, end;
+		{
+			Queue &queue = m_queues[victim];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			// another thief or the owner was faster, look again
+			if (queue.begin + 2 > queue.end) continue;
+
+			// the owner keeps working on the front, which it is likely
+			// already reading anyway
+			end   = queue.end;
+			begin = split(queue.begin, queue.end);
+			queue.end = begin;
+		}
+
+		Queue &queue = m_queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.begin = begin + 1;
+		queue.end   = end;
+		extent = begin;
+		return true;
+	}
+}
+
+void Executor::process(const Extent &extent, const ArchiveFds &archives, Buffer &buffer) {
+	const Vpk::ExtractionPlan::Entries &entries = m_plan.entries();
+
+	if (extent.size == 0) {
+		for (size_t i = extent.first; i < extent.first + extent.count; ++ i) {
+			std::exception_ptr error;
+			Status status = process(entries[i], 0, 0, error);
+			finish(i, status, error);
+		}
+		return;
+	}
+
+	const Archive &archive = archives.get(extent.index);
+	if (archive.fd < 0) {
+		fail(extent, ARCHIVE_ERROR, archive.error);
+		return;
+	}
+
+	if (m_zeroCopy || extent.size > m_plan.maxExtentSize()) {
+		// Big files aren't read into memory at once and zero copy data
+		// handlers don't need their data in memory at all.
+		for (size_t i = extent.first; i < extent.first + extent.count; ++ i) {
+			std::exception_ptr error;
+			Status status = stream(entries[i], archive.fd, buffer, error);
+			finish(i, status, error);
+		}
+		return;
+	}
+
+	buffer.reserve(extent.size);
+
+	try {
+		Vpk::Profiler::Timer timer(Vpk::Profile::READ);
+		pread_all(archive.fd, buffer.data(), extent.size, extent.offset);
+	}
+	catch (...) {
+		fail(extent, ARCHIVE_ERROR, std::current_exception());
+		return;
+	}
+
+	process(extent, buffer.data());
+}
+
+void Executor::process(const Extent &extent, const char *data) {
+	const Vpk::ExtractionPlan::Entries &entries = m_plan.entries();
+
+	for (size_t i = extent.first; i < extent.first + extent.count; ++ i) {
+		const Vpk::File *file = entries[i].file;
+		std::exception_ptr error;
+		Status status = process(entries[i], data + (file->offset - extent.offset), file->size, error);
+		finish(i, status, error);
+	}
+}
+
+void Executor::process(const Extent &extent) {
+	const Vpk::ExtractionPlan::Entries &entries = m_plan.entries();
+	Vpk::ArchiveSet::Span span;
+
+	if (extent.size == 0) {
+		for (size_t i = extent.first; i < extent.first + extent.count; ++ i) {
+			std::exception_ptr error;
+			Status status = process(entries[i], 0, 0, error);
+			finish(i, status, error);
+		}
+		return;
+	}
+
+	try {
+		span = m_mapped->span(extent.index, extent.offset, extent.size);
+	}
+	catch (...) {
+		// A cut short archive still holds the files in front of the cut,
+		// so look at every file on its own.
+		for (size_t i = extent.first; i < extent.first + extent.count; ++ i) {
+			std::exception_ptr error;
+			try {
+				span = m_mapped->span(entries[i].file);
+			}
+			catch (...) {
+				finish(i, ARCHIVE_ERROR, std::current_exception());
+				continue;
+			}
+			Status status = process(entries[i], span.data, span.size, error);
+			finish(i, status, error);
+		}
+		return;
+	}
+
+	for (size_t i = extent.first; i < extent.first + extent.count; ++ i) {
+		const Vpk::File *file = entries[i].file;
+		std::exception_ptr error;
+		Status status = process(entries[i], span.data + (file->offset - extent.offset), file->size, error);
+		finish(i, status, error);
+	}
+}
+
+void Executor::fail(const Extent &extent, Status status, std::exception_ptr error) {
+	for (size_t i = extent.first; i < extent.first + extent.count; ++ i) {
+		finish(i, status, error);
+	}
+}
+
+Status Executor::process(const Entry &entry, const char *data, size_t size, std::exception_ptr &error) {
+	const Vpk::File *file = entry.file;
+
+	try {
+		boost::scoped_ptr<Vpk::DataHandler> dataHandler(m_factory.create(entry.path, file->crc32));
+
+		size_t preloadSize = file->preload.size();
+		if (preloadSize > 0) {
+			dataHandler->process(&file->preload[0], preloadSize);
+		}
+
+		if (size > 0) {
+			dataHandler->process(data, size);
+		}
+
+		dataHandler->finish();
+	}
+	catch (...) {
+		error = std::current_exception();
+		return FILE_ERROR;
+	}
+
+	return SUCCESS;
+}
+
+Status Executor::stream(const Entry &entry, int fd, Buffer &buffer, std::exception_ptr &error) {
+	const Vpk::File *file = entry.file;
+	boost::scoped_ptr<Vpk::DataHandler> dataHandler;
+
+	try {
+		dataHandler.reset(m_factory.create(entry.path, file->crc32));
+
+		size_t preloadSize = file->preload.size();
+		if (preloadSize > 0) {
+			dataHandler->process(&file->preload[0], preloadSize);
+		}
+	}
+	catch (...) {
+		error = std::current_exception();
+		return FILE_ERROR;
+	}
+
+	off_t  offset = file->offset;
+	size_t left   = file->size;
+	try {
+		size_t count = dataHandler->copy(fd, offset, left);
+		offset += count;
+		left   -= count;
+	}
+	catch (const Vpk::IOError &exc) {
+		// There is no telling whether reading or writing failed, but
+		// running out of data is the archive's fault.
+		error = std::current_exception();
+		return exc.errnum() == EOF ? ARCHIVE_ERROR : FILE_ERROR;
+	}
+	catch (...) {
+		error = std::current_exception();
+		return FILE_ERROR;
+	}
+
+	if (left > 0) {
+		buffer.reserve(m_plan.maxExtentSize());
+	}
+
+	while (left > 0) {
+		size_t count = std::min(left, m_plan.maxExtentSize());
+		try {
+			Vpk::Profiler::Timer timer(Vpk::Profile::READ);
+			pread_all(fd, buffer.data(), count, offset);
+		}
+		catch (...) {
+			error = std::current_exception();
+			return ARCHIVE_ERROR;
+		}
+
+		try {
+			dataHandler->process(buffer.data(), count);
+		}
+		catch (...) {
+			error = std::current_exception();
+			return FILE_ERROR;
+		}
+
+		offset += count;
+		left   -= count;
+	}
+
+	try {
+		dataHandler->finish();
+	}
+	catch (...) {
+		error = std::current_exception();
+		return FILE_ERROR;
+	}
+
+	return SUCCESS;
+}
+
+void Executor::finish(size_t entry, Status status, std::exception_ptr error) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Result &result = m_results[entry];
+	result.status = status;
+	result.error  = error;
+	m_done.notify_all();
+}
+
+bool Executor::done(size_t entry) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_results[entry].status != PENDING;
+}
+
+Pipeline::Pipeline(
+	Executor &executor,
+	const ArchiveFds &archives,
+	unsigned int depth,
+	Vpk::AsyncReader::Backend backend)
+: m_executor(executor), m_archives(archives), m_slots(depth ? depth : 1),
+  m_reader(m_slots.size(), backend) {
+	for (size_t slot = m_slots.size(); slot > 0; -- slot) {
+		m_free.push_back(slot - 1);
+	}
+}
+
+void Pipeline::push(size_t index) {
+	const Vpk::ExtractionPlan &plan = m_executor.plan();
+	const Executor::Extent &extent = plan.extents()[index];
+	if (extent.size == 0 || extent.size > plan.maxExtentSize() || m_executor.zeroCopy() ||
+			m_archives.get(extent.index).fd < 0) {
+		m_executor.process(extent, m_archives, m_buffer);
+		return;
+	}
+
+	size_t slot = m_free.back();
+	m_free.pop_back();
+
+	Slot &entry = m_slots[slot];
+	entry.extent = index;
+	entry.buffer.reserve(extent.size);
+	Vpk::Profiler::Timer timer(Vpk::Profile::READ);
+	m_reader.read(m_archives.get(extent.index).fd, entry.buffer.data(), extent.size, extent.offset, slot);
+}
+
+void Pipeline::pop() {
+	Vpk::AsyncReader::Completion completion;
+	{
+		Vpk::Profiler::Timer timer(Vpk::Profile::READ);
+		if (!m_reader.wait(completion)) return;
+	}
+
+	size_t slot = completion.tag;
+	Slot &entry = m_slots[slot];
+	const Executor::Extent &extent = m_executor.plan().extents()[entry.extent];
+	if (completion.error) {
+		m_executor.fail(extent, ARCHIVE_ERROR, std::make_exception_ptr(Vpk::IOError(completion.error)));
+	}
+	else {
+		Vpk::Profiler::count(Vpk::Profile::BYTES_READ, extent.size);
+		if (m_reader.backend() == Vpk::AsyncReader::PREAD) {
+			Vpk::Profiler::count(Vpk::Profile::SYSCALLS);
+		}
+		m_executor.process(extent, entry.buffer.data());
+	}
+	m_free.push_back(slot);
+}
+
+const Result &Executor::wait(size_t entry) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	const Result &result = m_results[entry];
+	while (result.status == PENDING && !m_error) {
+		m_done.wait(lock);
+	}
+	return result;
+}
+
+void Vpk::Package::process(const ExtractionPlan &plan, DataHandlerFactory &factory, unsigned int threads) const {
+	Profiler::Activation activation(m_profiler.get());
+	if (m_handler) m_handler->begin(*this);
+
+	const ExtractionPlan::Dirs &dirs = plan.dirs();
+	for (ExtractionPlan::Dirs::const_iterator i = dirs.begin(); i != dirs.end(); ++ i) {
+		try {
+			factory.mkdir(*i);
+		}
+		catch (const std::exception &exc) {
+			if (direrror(exc, *i)) throw;
+		}
+	}
+
+	const ExtractionPlan::Entries &entries = plan.entries();
+	const ExtractionPlan::Extents &extents = plan.extents();
+	boost::scoped_ptr<ArchiveSet> mapped;
+	if (m_mapped) {
+		mapped.reset(new ArchiveSet(*this));
+		mapped->map(plan);
+	}
+
+	Executor executor(*this, plan, factory, mapped.get());
+	Threads pool(executor);
+	boost::scoped_ptr<ArchiveFds> archives;
+	boost::scoped_ptr<Pipeline> pipeline;
+
+	if (threads > 1) {
+		pool.start(std::min((size_t) threads, extents.size()));
+	}
+	else if (!mapped) {
+		archives.reset(new ArchiveFds(*this, plan));
+		pipeline.reset(new Pipeline(executor, *archives, m_readDepth, m_readBackend));
+	}
+
+	size_t extent = 0;
+	for (size_t i = 0; i < entries.size(); ++ i) {
+		const ExtractionPlan::Entry &entry = entries[i];
+		if (m_handler) m_handler->extract(entry.path);
+
+		// keep the reads of the following extents in flight
+		while (pipeline && !executor.done(i)) {
+			if (!pipeline->full() && extent < extents.size()) {
+				pipeline->push(extent ++);
+			}
+			else {
+				pipeline->pop();
+			}
+		}
+
+		// mapped archives need no reads, just catch up with the entry
+		while (mapped && threads <= 1 && !executor.done(i)) {
+			executor.process(extents[extent ++]);
+		}
+
+		const Result &result = executor.wait(i);
+		if (result.status == PENDING) {
+			// a worker failed
+			break;
+		}
+		if (result.status == SUCCESS) {
+			if (m_handler) m_handler->success(entry.path);
+			continue;
+		}
+
+		try {
+			std::rethrow_exception(result.error);
+		}
+		catch (const std::exception &exc) {
+			bool raise = result.status == ARCHIVE_ERROR ?
+				archiveerror(exc, archivePath(entry.file->index).string()) :
+				fileerror(exc, entry.path);
+			if (raise) throw;
+		}
+	}
+
+	pool.join();
+
+	std::exception_ptr error = executor.error();
+	if (error) std::rethrow_exception(error);
+
+	if (m_handler) m_handler->end();
+	stats();
+}
+
+void Vpk::Package::process(DataHandlerFactory &factory, unsigned int threads) const {
+	Profiler::Activation activation(m_profiler.get());
+	ExtractionPlan plan;
+	{
+		Profiler::Timer timer(Profile::PLAN);
+		plan.add(*this);
+		plan.build();
+	}
+	process(plan, factory, threads);
+}
+
+void Vpk::Package::process(DataHandlerFactory &factory) const {
+	process(factory, 1);
+}
+
+void Vpk::Package::extract(const std::string &destdir, bool check) const {
+	extract(destdir, check, 1);
+}
+
+void Vpk::Package::extract(const std::string &destdir, bool check, unsigned int threads) const {
+	FileDataHandlerFactory factory(destdir, check);
+	process(factory, threads);
+}
+
+void Vpk::Package::check() const {
+	check(1);
+}
+
+void Vpk::Package::check(unsigned int threads) const {
+	CheckingDataHandlerFactory factory;
+	process(factory, threads);
+}
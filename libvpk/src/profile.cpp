@@ -0,0 +1,64 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <vpk/profile.h>
+
+thread_local Vpk::Profiler *Vpk::Profiler::s_current = 0;
+
+static const char *phaseNames[] = { "index", "plan", "mkdir", "open", "read", "check", "write" };
+static const char *counterNames[] = { "bytes read", "bytes written", "syscalls", "files opened", "mkdirs" };
+
+void Vpk::Profile::clear() {
+	for (int i = 0; i < PHASES; ++ i) {
+		time[i]  = 0;
+		calls[i] = 0;
+	}
+	for (int i = 0; i < COUNTERS; ++ i) {
+		counters[i] = 0;
+	}
+}
+
+const char *Vpk::Profile::name(Phase phase) {
+	return phase < PHASES ? phaseNames[phase] : "?";
+}
+
+const char *Vpk::Profile::name(Counter counter) {
+	return counter < COUNTERS ? counterNames[counter] : "?";
+}
+
+Vpk::Profile Vpk::Profiler::profile() const {
+	Profile profile;
+	for (int i = 0; i < Profile::PHASES; ++ i) {
+		profile.time[i]  = m_time[i].load(std::memory_order_relaxed);
+		profile.calls[i] = m_calls[i].load(std::memory_order_relaxed);
+	}
+	for (int i = 0; i < Profile::COUNTERS; ++ i) {
+		profile.counters[i] = m_counters[i].load(std::memory_order_relaxed);
+	}
+	return profile;
+}
+
+void Vpk::Profiler::clear() {
+	for (int i = 0; i < Profile::PHASES; ++ i) {
+		m_time[i].store(0, std::memory_order_relaxed);
+		m_calls[i].store(0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < Profile::COUNTERS; ++ i) {
+		m_counters[i].store(0, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,103 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <boost/functional/hash.hpp>
+
+#include <vpk/string_pool.h>
+#include <vpk/exception.h>
+
+Vpk::StringPool::StringPool() :
+	m_data(1, 0), m_index(0, Hash(&m_data), Equal(&m_data)), m_frozen(false) {}
+
+Vpk::StringPool::StringPool(const StringPool &other) :
+	m_data(other.m_data), m_index(0, Hash(&m_data), Equal(&m_data)), m_frozen(other.m_frozen) {
+	if (!m_frozen) reindex();
+}
+
+Vpk::StringPool &Vpk::StringPool::operator = (const StringPool &other) {
+	m_data   = other.m_data;
+	m_frozen = other.m_frozen;
+	m_index.clear();
+	if (!m_frozen) reindex();
+	return *this;
+}
+
+size_t Vpk::StringPool::Hash::operator () (Id id) const {
+	const char *str = &(*data)[id];
+	return boost::hash_range(str, str + strlen(str));
+}
+
+size_t Vpk::StringPool::Hash::operator () (const Key &key) const {
+	return boost::hash_range(key.str, key.str + key.length);
+}
+
+bool Vpk::StringPool::Equal::operator () (const Key &lhs, Id rhs) const {
+	const char *str = &(*data)[rhs];
+	return strncmp(str, lhs.str, lhs.length) == 0 && str[lhs.length] == 0;
+}
+
+Vpk::StringPool::Id Vpk::StringPool::intern(const char *str, size_t length) {
+	if (length == 0) return 0;
+
+	Key key(str, length);
+	Index::const_iterator i = m_index.find(key, m_index.hash_function(), m_index.key_eq());
+	if (i != m_index.end()) {
+		return *i;
+	}
+
+	if (m_frozen) {
+		throw Exception("string pool is frozen");
+	}
+
+	if (m_data.size() + length + 1 > 0xffffffffUL) {
+		throw Exception("string pool exceeds 4 GB");
+	}
+
+	Id id = m_data.size();
+	m_data.insert(m_data.end(), str, str + length);
+	m_data.push_back(0);
+	m_index.insert(id);
+
+	return id;
+}
+
+void Vpk::StringPool::freeze() {
+	Index empty(0, Hash(&m_data), Equal(&m_data));
+	m_index.swap(empty);
+	m_frozen = true;
+}
+
+void Vpk::StringPool::clear() {
+	m_data.assign(1, 0);
+	m_index.clear();
+	m_frozen = false;
+}
+
+void Vpk::StringPool::reindex() {
+	m_index.clear();
+	for (size_t i = 1; i < m_data.size(); i += strlen(&m_data[i]) + 1) {
+		m_index.insert(i);
+	}
+}
+
+size_t Vpk::StringPool::memoryUsage() const {
+	// each set node holds the value, a next pointer and the cached hash
+	return m_data.capacity() +
+		m_index.bucket_count() * sizeof(void*) +
+		m_index.size() * (sizeof(Id) + sizeof(void*) + sizeof(size_t));
+}
@@ -0,0 +1,80 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <vpk/tree_iterator.h>
+#include <vpk/dir.h>
+#include <vpk/file.h>
+
+// deep enough for any real archive, so the buffers never grow
+enum {
+	INITIAL_DEPTH = 32,
+	INITIAL_PATH  = 512
+};
+
+Vpk::TreeIterator::TreeIterator(const Dir &dir, const std::string &prefix) :
+	m_node(0), m_step(FILE), m_pruned(false) {
+	init(dir.nodes(), prefix);
+	m_stack.back().dir = &dir;
+}
+
+Vpk::TreeIterator::TreeIterator(const Nodes &nodes, const std::string &prefix) :
+	m_node(0), m_step(FILE), m_pruned(false) {
+	init(nodes, prefix);
+}
+
+void Vpk::TreeIterator::init(const Nodes &nodes, const std::string &prefix) {
+	m_stack.reserve(INITIAL_DEPTH);
+	m_path.reserve(prefix.size() + INITIAL_PATH);
+	m_path = prefix;
+	m_stack.push_back(Frame(0, nodes, prefix.size()));
+}
+
+bool Vpk::TreeIterator::next() {
+	if (m_node && m_step == ENTER && !m_pruned) {
+		const Dir *dir = (const Dir*) m_node;
+		m_stack.push_back(Frame(dir, dir->nodes(), m_path.size()));
+	}
+	m_pruned = false;
+
+	while (!m_stack.empty()) {
+		Frame &top = m_stack.back();
+		m_path.resize(top.length);
+
+		if (top.it != top.end) {
+			m_node = top.it->second.get();
+			++ top.it;
+
+			if (top.length > 0) m_path += '/';
+			m_path += m_node->name();
+			m_step = m_node->type() == Node::DIR ? ENTER : FILE;
+			return true;
+		}
+
+		const Dir *dir = top.dir;
+		m_stack.pop_back();
+		if (!m_stack.empty()) {
+			// m_path is the path of dir again
+			m_node = dir;
+			m_step = LEAVE;
+			return true;
+		}
+	}
+
+	m_node = 0;
+	return false;
+}
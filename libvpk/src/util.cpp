@@ -16,23 +16,37 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 #include <algorithm>
 
 #include <boost/algorithm/string.hpp>
 
 #include <vpk/util.h>
+#include <vpk/io_error.h>
+#include <vpk/profile.h>
 
 namespace fs = boost::filesystem;
 
 static void mkpath(const fs::path &path) {
 	fs::path parent = path.parent_path();
+	// stat() of the parent and mkdir()
+	Vpk::Profiler::count(Vpk::Profile::SYSCALLS, 2);
 	if (!fs::exists(parent)) {
 		mkpath(parent);
 	}
-	fs::create_directory(path);
+	if (fs::create_directory(path)) {
+		Vpk::Profiler::count(Vpk::Profile::MKDIRS);
+	}
 }
 
 void Vpk::create_path(const fs::path &path) {
+	Profiler::Timer timer(Profile::MKDIR);
 	mkpath(fs::system_complete(path));
 }
 
@@ -46,3 +60,44 @@ std::string &Vpk::tolower(std::string &s) {
 	std::transform(s.begin(), s.end(), s.begin(), (int (*)(int)) std::tolower);
 	return s;
 }
+
+#if defined(__linux__)
+// errors that mean the kernel can't copy between these files at all
+static bool unsupported(int errnum) {
+	return errnum == ENOSYS || errnum == EXDEV || errnum == EINVAL || errnum == EOPNOTSUPP;
+}
+#endif
+
+size_t Vpk::copy_range(int infd, off_t offset, int outfd, size_t size) {
+	size_t left = size;
+#if defined(__linux__)
+	bool range = true;
+	while (left > 0) {
+		ssize_t count = range ?
+			copy_file_range(infd, &offset, outfd, NULL, left, 0) :
+			sendfile(outfd, infd, &offset, left);
+		Profiler::count(Profile::SYSCALLS);
+
+		if (count < 0) {
+			int errnum = errno;
+			if (errnum == EINTR) continue;
+			if (unsupported(errnum) && range) {
+				// e.g. copies between different filesystems on older kernels
+				range = false;
+				continue;
+			}
+			if (unsupported(errnum)) break;
+			throw IOError(errnum);
+		}
+		else if (count == 0) {
+			throw IOError(EOF);
+		}
+		left -= count;
+	}
+#else
+	(void) infd;
+	(void) offset;
+	(void) outfd;
+#endif
+	return size - left;
+}
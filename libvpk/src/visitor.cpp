@@ -0,0 +1,50 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <vpk/visitor.h>
+#include <vpk/tree_iterator.h>
+
+static void visit(Vpk::TreeIterator &it, Vpk::Visitor &visitor) {
+	while (it.next()) {
+		switch (it.step()) {
+		case Vpk::TreeIterator::FILE:
+			visitor.file(it.path(), it.file());
+			break;
+
+		case Vpk::TreeIterator::ENTER:
+			if (!visitor.enter(it.path(), it.dir())) {
+				it.prune();
+			}
+			break;
+
+		case Vpk::TreeIterator::LEAVE:
+			visitor.leave(it.path(), it.dir());
+			break;
+		}
+	}
+}
+
+void Vpk::visit(const Dir &dir, Visitor &visitor, const std::string &prefix) {
+	TreeIterator it(dir, prefix);
+	::visit(it, visitor);
+}
+
+void Vpk::visit(const Nodes &nodes, Visitor &visitor, const std::string &prefix) {
+	TreeIterator it(nodes, prefix);
+	::visit(it, visitor);
+}
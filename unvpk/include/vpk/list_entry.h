@@ -25,12 +25,16 @@
 
 #include <vpk/file.h>
 #include <vpk/console_table.h>
+#include <vpk/visitor.h>
 
 namespace Vpk {
 	class ListEntry {
 	public:
-		ListEntry(const std::string &path, File *file)
+		ListEntry(const std::string &path, const File *file)
 			: path(path), file(file) {}
+
+		ListEntry(PathRef path, const File *file)
+			: path(path.data(), path.size()), file(file) {}
 		
 		template<typename SizeFormatter>
 		void insert(ConsoleTable &table, SizeFormatter szfmt) const {
@@ -65,7 +69,7 @@ namespace Vpk {
 		}
 	
 		std::string path;
-		File *file;
+		const File *file;
 	};
 	
 	typedef std::vector<ListEntry> List;
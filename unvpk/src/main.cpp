@@ -16,10 +16,13 @@
  * License along with this library; if not, write to the Free Software
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
+#include <time.h>
+
 #include <string>
 #include <iostream>
 #include <exception>
 #include <map>
+#include <atomic>
 
 #include <boost/filesystem/operations.hpp>
 #include <boost/program_options.hpp>
@@ -30,7 +33,12 @@
 
 #include <vpk.h>
 #include <vpk/util.h>
+#include <vpk/compact_tree.h>
+#include <vpk/lazy_index.h>
+#include <vpk/index_cache.h>
 #include <vpk/console_handler.h>
+#include <vpk/checking_data_handler.h>
+#include <vpk/data_handler_factory.h>
 #include <vpk/console_table.h>
 #include <vpk/archive_stat.h>
 #include <vpk/coverage.h>
@@ -58,29 +66,27 @@ static void usage(const po::options_description &desc) {
 		"(c) 2011 Mathias Panzenböck\n";
 }
 
-static void printListing(
-		const Nodes &nodes,
-		const std::vector<std::string> &prefix,
-		List &lst,
-		size_t &files,
-		size_t &dirs,
-		size_t &sumsize) {
-	for (Nodes::const_iterator it = nodes.begin(); it != nodes.end(); ++ it) {
-		Node *node = it->second.get();
-		std::vector<std::string> path(prefix);
-		path.push_back(node->name());
-		if (node->type() == Node::DIR) {
-			printListing(((const Dir*) node)->nodes(), path, lst, files, dirs, sumsize);
-			++ dirs;
-		}
-		else {
-			File *file = (File *) node;
-			lst.push_back(ListEntry(algo::join(path, "/"), file));
-			sumsize += file->preload.size() + file->size;
-			++ files;
-		}
+class ListingVisitor : public Visitor {
+public:
+	ListingVisitor(List &lst) : lst(lst), files(0), dirs(0), sumsize(0) {}
+
+	void leave(PathRef path, const Dir &dir) {
+		(void) path;
+		(void) dir;
+		++ dirs;
 	}
-}
+
+	void file(PathRef path, const File &file) {
+		lst.push_back(ListEntry(path, &file));
+		sumsize += file.preload.size() + file.size;
+		++ files;
+	}
+
+	List  &lst;
+	size_t files;
+	size_t dirs;
+	size_t sumsize;
+};
 
 static size_t bytes(size_t size) {
 	return size;
@@ -101,9 +107,9 @@ static void fillTable(const List &lst, ConsoleTable &table, SizeFormatter szfmt)
 
 static void printListing(const Package &package, bool humanreadable, const SortKeys &sorting) {
 	List lst;
-	size_t files = 0, dirs = 0, sumsize = 0;
-
-	printListing(package.nodes(), std::vector<std::string>(), lst, files, dirs, sumsize);
+	ListingVisitor visitor(lst);
+	visit(package, visitor);
+	size_t files = visitor.files, dirs = visitor.dirs, sumsize = visitor.sumsize;
 
 	if (!sorting.empty()) {
 		Sorter sorter(sorting);
@@ -131,17 +137,65 @@ static void printListing(const Package &package, bool humanreadable, const SortK
 	std::cout << " total size), " << dirs << " " << (dirs == 1 ? "directory" : "directories") << "\n";
 }
 
+// adds the size of each file whose checksum matched to verified
+class VerifyingDataHandler : public CheckingDataHandler {
+public:
+	VerifyingDataHandler(const std::string &path, uint32_t crc32, std::atomic<uint64_t> &verified) :
+		CheckingDataHandler(path, crc32), m_verified(verified), m_size(0) {}
+
+	void process(const char *buffer, size_t length) {
+		CheckingDataHandler::process(buffer, length);
+		m_size += length;
+	}
+
+	void finish() {
+		CheckingDataHandler::finish();
+		m_verified += m_size;
+	}
+
+private:
+	std::atomic<uint64_t> &m_verified;
+	uint64_t               m_size;
+};
+
+class VerifyingDataHandlerFactory : public DataHandlerFactory {
+public:
+	VerifyingDataHandlerFactory() : m_verified(0) {}
+
+	VerifyingDataHandler *create(const std::string &path, uint32_t crc32) {
+		return new VerifyingDataHandler(path, crc32, m_verified);
+	}
+
+	uint64_t verified() const { return m_verified; }
+
+private:
+	std::atomic<uint64_t> m_verified;
+};
+
+static void check(const Package &package, const ConsoleHandler &handler, unsigned int jobs, bool humanreadable) {
+	VerifyingDataHandlerFactory factory;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	package.process(factory, jobs);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	// a throughput of a partial check would be meaningless
+	if (!handler.allok()) return;
+
+	uint64_t size = factory.verified();
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	std::cout << boost::format("checked %s in %.2f s (%.1f MB/s)\n") %
+		sizeToString(size, humanreadable) % secs %
+		(secs > 0 ? size / secs / 1000000.0 : 0.0);
+}
+
 typedef std::map<int,ArchiveStat> Stats;
 
 static void archive_stat(const Dir &dir, Stats &stats) {
-	for (Dir::const_iterator i = dir.begin(); i != dir.end(); ++ i) {
-		Node *node = i->second.get();
-		if (node->type() == Node::DIR) {
-			archive_stat(*(Dir*) node, stats);
-		}
-		else {
-			File *file = (File*) node;
-			stats[file->index].add(*file);
+	for (TreeIterator it(dir); it.next();) {
+		if (it.step() == TreeIterator::FILE) {
+			const File &file = it.file();
+			stats[file.index].add(file);
 		}
 	}
 }
@@ -197,7 +251,7 @@ static void printStats(
 	size_t uncovered = 0;
 	size_t total = 0;
 	const size_t magicSize = Magic::maxSize();
-	std::vector<char> magic(magicSize, 0);
+	ArchiveSet archives(package);
 	for (Stats::const_iterator i = stats.begin(); i != stats.end(); ++ i) {
 		fs::path path = package.archivePath(i->first);
 		std::string archive = path.filename().string();
@@ -236,25 +290,22 @@ static void printStats(
 
 		if (dump) {
 			std::string prefix = (destdir / archive).string();
-			FileIO arch(fs::path(package.srcdir()) / archive, "rb");
+			uint16_t index = i->first;
+			archives.map(index);
 
 			const Coverage::Slices &slices = missing.slices();
 			for (Coverage::Slices::const_iterator i = slices.begin(); i != slices.end(); ++ i) {
-				arch.seek(i->first, FileIO::SET);
-				size_t count = std::min(i->second, magicSize);
-				arch.read(&magic[0], count);
+				ArchiveSet::Span span = archives.span(index, i->first, i->second);
 
-				std::string type = Magic::extensionOf(&magic[0], count);
+				std::string type = Magic::extensionOf(span.data, std::min(span.size, magicSize));
 				std::string filename = (boost::format("%s_%lu_%lu.%s") % prefix % i->first % i->second % type).str();
 				std::string sizeStr = sizeToString(i->second, humanreadable);
 				std::cout << "Dumping " << sizeStr << " to \"" << filename << "\"\n";
 
 				FileIO out(filename, "wb");
-				out.write(&magic[0], count);
-				if (count < i->second) {
-					arch.read(out, i->second - count);
-				}
+				out.write(span.data, span.size);
 			}
+			archives.clear();
 			std::cout << std::endl;
 		}
 	}
@@ -298,6 +349,158 @@ static void printStats(
 	sizesTbl.print(std::cout);
 }
 
+struct MemoryUsage {
+	MemoryUsage() : nodes(0), names(0), preload(0), lookup(0), files(0) {}
+
+	size_t total() const { return nodes + names + preload + lookup; }
+
+	size_t nodes;
+	size_t names;
+	size_t preload;
+	size_t lookup;
+	size_t files;
+};
+
+// approximate size of a glibc malloc chunk holding size bytes
+static size_t chunk(size_t size) {
+	size_t chunk = (size + sizeof(size_t) + 15) & ~(size_t)15;
+	return chunk < 32 ? 32 : chunk;
+}
+
+static size_t stringUsage(const std::string &str) {
+	// short strings are stored inline (SSO)
+	return str.capacity() > 15 ? chunk(str.capacity() + 1) : 0;
+}
+
+// the control block of a boost::shared_ptr constructed from a raw pointer
+static const size_t SHARED_COUNT_SIZE = 3 * sizeof(void*);
+
+static void lookupUsage(const Nodes &nodes, MemoryUsage &usage) {
+	// buckets plus per entry: the key/value pair, a next pointer and the
+	// cached hash value
+	usage.lookup += chunk((nodes.bucket_count() + 1) * sizeof(void*));
+	usage.lookup += nodes.size() * chunk(sizeof(Nodes::value_type) + sizeof(void*) + sizeof(size_t));
+}
+
+static void memoryUsage(const Dir &root, MemoryUsage &usage) {
+	lookupUsage(root.nodes(), usage);
+
+	for (TreeIterator it(root); it.next();) {
+		const Node &node = it.node();
+		if (it.step() == TreeIterator::LEAVE) continue;
+
+		// the key is a copy of the name, which allocates exactly its size
+		const std::string &name = node.name();
+		usage.names += stringUsage(name) + (name.size() > 15 ? chunk(name.size() + 1) : 0);
+		usage.nodes += chunk(SHARED_COUNT_SIZE);
+		if (it.step() == TreeIterator::ENTER) {
+			usage.nodes += chunk(sizeof(Dir));
+			lookupUsage(it.dir().nodes(), usage);
+		}
+		else {
+			const File &file = it.file();
+			usage.nodes += chunk(sizeof(File));
+			if (file.preload.capacity() > 0) {
+				usage.preload += chunk(file.preload.capacity());
+			}
+			++ usage.files;
+		}
+	}
+}
+
+static void printMemoryUsage(const Package &package, bool humanreadable) {
+	MemoryUsage classic;
+	memoryUsage(package, classic);
+
+	// a package read through the index cache is built on top of a compact
+	// tree already, so report that one instead of parsing another
+	const LazyIndex *lazyIndex = package.lazyIndex();
+	bool inuse = lazyIndex && lazyIndex->tree.dircount() > 0;
+	CompactTree parsed;
+	if (!inuse) {
+		parsed.read(fs::path(package.srcdir()) / package.dirfile());
+	}
+	const CompactTree &tree = inuse ? lazyIndex->tree : parsed;
+
+	MemoryUsage compact;
+	compact.nodes   = tree.recordsMemoryUsage();
+	compact.names   = tree.stringsMemoryUsage();
+	compact.preload = tree.preloadMemoryUsage();
+	compact.files   = tree.filecount();
+
+	const MemoryUsage *layouts[] = { &classic, &compact };
+	const char *names[] = { "Node tree", inuse ? "Compact (in use)" : "Compact" };
+
+	ConsoleTable table;
+	table.columns(ConsoleTable::LEFT, ConsoleTable::RIGHT, ConsoleTable::RIGHT,
+	              ConsoleTable::RIGHT, ConsoleTable::RIGHT, ConsoleTable::RIGHT,
+	              ConsoleTable::RIGHT, ConsoleTable::RIGHT);
+	table.row("Layout", "Files", "Nodes", "Names", "Preload", "Lookup", "Total", "Per File");
+	for (size_t i = 0; i < 2; ++ i) {
+		const MemoryUsage &usage = *layouts[i];
+		table.row(names[i], usage.files,
+			sizeToString(usage.nodes, humanreadable),
+			sizeToString(usage.names, humanreadable),
+			sizeToString(usage.preload, humanreadable),
+			sizeToString(usage.lookup, humanreadable),
+			sizeToString(usage.total(), humanreadable),
+			usage.files ? usage.total() / usage.files : 0);
+	}
+
+	table.print(std::cout);
+	std::cout << "\nNode tree sizes are estimated heap usage including allocator overhead.\n";
+	if (tree.mapped()) {
+		std::cout << "The compact tree is mapped from the index cache ("
+		          << sizeToString(tree.mappedSize(), humanreadable) << ") and uses no heap.\n";
+	}
+}
+
+// keeps the totals of the last read() or process(), see --profile
+class ProfileHandler : public StatsHandler {
+public:
+	void stats(const Package&, const Profile &profile) { m_profile = profile; }
+
+	const Profile &profile() const { return m_profile; }
+
+private:
+	Profile m_profile;
+};
+
+static void printProfile(const Profile &profile, double secs, bool humanreadable) {
+	uint64_t total = 0;
+	for (int i = 0; i < Profile::PHASES; ++ i) {
+		total += profile.time[i];
+	}
+
+	ConsoleTable phases;
+	phases.columns(ConsoleTable::LEFT, ConsoleTable::RIGHT, ConsoleTable::RIGHT, ConsoleTable::RIGHT);
+	phases.row("Phase", "Time", "%", "Calls");
+	for (int i = 0; i < Profile::PHASES; ++ i) {
+		phases.row(Profile::name((Profile::Phase) i),
+			boost::format("%.3f s") % (profile.time[i] * 1e-9),
+			boost::format("%.0lf%%") % (total ? profile.time[i] * (double)100 / total : 0.0),
+			profile.calls[i]);
+	}
+	phases.row("Wall clock", boost::format("%.3f s") % secs, "", "");
+
+	ConsoleTable counters;
+	counters.columns(ConsoleTable::LEFT, ConsoleTable::RIGHT);
+	for (int i = 0; i < Profile::COUNTERS; ++ i) {
+		uint64_t value = profile.counters[i];
+		if (i == Profile::BYTES_READ || i == Profile::BYTES_WRITTEN) {
+			counters.row(boost::format("%s:") % Profile::name((Profile::Counter) i), sizeToString(value, humanreadable));
+		}
+		else {
+			counters.row(boost::format("%s:") % Profile::name((Profile::Counter) i), value);
+		}
+	}
+
+	phases.print(std::cout);
+	std::cout.put('\n');
+	counters.print(std::cout);
+	std::cout << "\nTimes of worker threads add up, so with -j the phases can take longer than\nthe wall clock time.\n";
+}
+
 int main(int argc, char *argv[]) {
 	po::options_description desc("Options");
 	desc.add_options()
@@ -315,10 +518,20 @@ int main(int argc, char *argv[]) {
 		("check,c",          "check CRC32 sums")
 		("xcheck,x",         "extract and check CRC32 sums")
 		("directory,C",      po::value<std::string>(), "extract files into another directory")
+		("jobs,j",           po::value<unsigned int>()->default_value(1), "number of threads used for extraction and checking")
+		("io",               po::value<std::string>()->default_value("io_uring"), "how archives are read when extracting or checking:\n"
+		                     "    io_uring  asynchronously, if supported\n"
+		                     "    pread     one read at a time\n"
+		                     "    mmap      map the archives and process them in place")
+		("io-depth",         po::value<unsigned int>()->default_value(AsyncReader::DEFAULT_DEPTH), "number of reads each thread keeps in flight")
 		("stop,s",           "stop on error")
 		("stats",            "print some statistics and coverage analysis of archive data (archive debugging)")
 		("all,a",            "also show archives with 100% coverage in statistics")
-		("dump-uncovered",   "dump uncovered areas into files (implies --stats, archive debugging)");
+		("dump-uncovered",   "dump uncovered areas into files (implies --stats, archive debugging)")
+		("memory-usage",     "compare the memory usage of the node tree and the compact index layout (ignores FILEs)")
+		("index-cache",      "cache the parsed archive index in $XDG_CACHE_HOME/vpk (default: ~/.cache/vpk)")
+		("verify-index-cache", "check all of a cached index and the archive index before using it (implies --index-cache)")
+		("profile",          "print where the time went when reading, extracting or checking");
 
 	po::options_description hidden;
 	hidden.add_options()
@@ -358,8 +571,22 @@ int main(int argc, char *argv[]) {
 	bool stop          = vm.count("stop")           > 0;
 	bool stats         = vm.count("stats")          > 0;
 	bool dump          = vm.count("dump-uncovered") > 0;
+	bool memusage      = vm.count("memory-usage")   > 0;
+	bool verifycache   = vm.count("verify-index-cache") > 0;
+	bool indexcache    = vm.count("index-cache")    > 0 || verifycache;
 	bool humanreadable = vm.count("human-readable") > 0;
 	bool printall      = vm.count("all")            > 0;
+	bool profile       = vm.count("profile")        > 0;
+
+	unsigned int jobs  = vm["jobs"].as<unsigned int>();
+	unsigned int depth = vm["io-depth"].as<unsigned int>();
+
+	AsyncReader::Backend backend = AsyncReader::PREAD;
+	bool mapped = vm["io"].as<std::string>() == "mmap";
+	if (!mapped && !AsyncReader::parse(vm["io"].as<std::string>().c_str(), backend)) {
+		std::cerr << "*** error: illegal io backend: \"" << vm["io"].as<std::string>() << "\"\n";
+		return 1;
+	}
 
 	std::string directory = vm.count("directory") > 0 ? vm["directory"].as<std::string>() : std::string(".");
 	std::string archive   = vm.count("archive")   > 0 ? vm["archive"].as<std::string>()   : std::string("-");
@@ -416,10 +643,32 @@ int main(int argc, char *argv[]) {
 	}
 
 	ConsoleHandler handler(stop);
+	ProfileHandler profileHandler;
 	Package package(&handler);
+	if (profile) {
+		package.setStatsHandler(&profileHandler);
+	}
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	package.setReadBackend(backend);
+	package.setReadDepth(depth);
+	package.setMapped(mapped);
 
 	try {
-		package.read(archive);
+		if (indexcache) {
+			IndexCache cache;
+			cache.setVerify(verifycache);
+			package.read(archive, cache);
+		}
+		else {
+			package.read(archive);
+		}
+
+		if (memusage) {
+			printMemoryUsage(package, humanreadable);
+			return 0;
+		}
 
 		if (!filter.empty()) {
 			package.filter(filter);
@@ -432,13 +681,13 @@ int main(int argc, char *argv[]) {
 			printListing(package, humanreadable, sorting);
 		}
 		else if (xcheck) {
-			package.extract(directory, true);
+			package.extract(directory, true, jobs);
 		}
 		else if (check) {
-			package.check();
+			::check(package, handler, jobs, humanreadable);
 		}
 		else {
-			package.extract(directory, false);
+			package.extract(directory, false, jobs);
 		}
 	}
 	catch (const std::exception &exc) {
@@ -446,5 +695,12 @@ int main(int argc, char *argv[]) {
 		return 1;
 	}
 
+	if (profile) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+		std::cout.put('\n');
+		printProfile(profileHandler.profile(), secs, humanreadable);
+	}
+
 	return handler.allok() ? 0 : 1;
 }
@@ -0,0 +1,47 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_RANDOM_H
+#define VPK_RANDOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Vpk {
+	// xorshift64*, so runs with the same seed see the same data on every platform
+	class Random {
+	public:
+		Random(uint64_t seed) : m_state(seed ? seed : 1) {}
+
+		uint64_t next() {
+			m_state ^= m_state >> 12;
+			m_state ^= m_state << 25;
+			m_state ^= m_state >> 27;
+			return m_state * 2685821657736338717ULL;
+		}
+
+		size_t range(size_t min, size_t max) {
+			return min + next() % (max - min + 1);
+		}
+
+	private:
+		uint64_t m_state;
+	};
+}
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_VPK_GENERATOR_H
+#define VPK_VPK_GENERATOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include <vpk/random.h>
+
+namespace Vpk {
+	// Writes synthetic version 1 VPKs with random contents for benchmarks.
+	// The same options always give the same archive, byte for byte.
+	class VpkGenerator {
+	public:
+		enum Sizes {
+			SIZES_VPK,     // the mix of vpkFileSize()
+			SIZES_FIXED,   // all files have minSize bytes
+			SIZES_UNIFORM  // evenly distributed in [minSize, maxSize]
+		};
+
+		struct Options {
+			Options() : files(100000), sizes(SIZES_VPK), minSize(0), maxSize(0),
+				preload(0), depth(3), fanout(8), archives(4), seed(1) {}
+
+			// "vpk", "SIZE" or "MIN-MAX" (in bytes), false if spec is malformed
+			bool parseSizes(const std::string &spec);
+
+			size_t       files;
+			Sizes        sizes;
+			size_t       minSize;
+			size_t       maxSize;
+			size_t       preload;  // at most this many bytes of a file are preload data
+			unsigned int depth;    // dirs are up to this many levels deep
+			unsigned int fanout;   // subdirs per dir
+			unsigned int archives; // number of *_NNN.vpk files, with 0 all data is in the *_dir.vpk
+			uint64_t     seed;
+		};
+
+		VpkGenerator(const Options &options) : m_options(options), m_bytes(0) {}
+
+		// Writes dirfile, which has to be named "*_dir.vpk", and the
+		// *_NNN.vpk files next to it. Data that is stored in the *_dir.vpk
+		// file is held in memory until the index is written.
+		void write(const boost::filesystem::path &dirfile);
+
+		// size of all files of the last write(), including preload data
+		uint64_t bytes() const { return m_bytes; }
+
+		const Options &options() const { return m_options; }
+
+		// Roughly what the Source engine VPKs look like: mostly small
+		// scripts, materials and models, some textures and sounds and a few
+		// big files.
+		static size_t vpkFileSize(Random &random);
+
+	private:
+		size_t fileSize(Random &random) const;
+
+		Options  m_options;
+		uint64_t m_bytes;
+	};
+}
+
+#endif
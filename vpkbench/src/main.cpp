@@ -0,0 +1,1134 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdint.h>
+#include <time.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <exception>
+#include <atomic>
+#include <thread>
+
+#include <boost/program_options.hpp>
+#include <boost/format.hpp>
+#include <boost/crc.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <vpk/version.h>
+#include <vpk/crc32.h>
+#include <vpk/io_error.h>
+#include <vpk/file_data_handler.h>
+#include <vpk/file_data_handler_factory.h>
+#include <vpk/package.h>
+#include <vpk/handler.h>
+#include <vpk/file.h>
+#include <vpk/compact_tree.h>
+#include <vpk/extraction_plan.h>
+#include <vpk/tree_iterator.h>
+#include <vpk/visitor.h>
+#include <vpk/random.h>
+#include <vpk/vpk_generator.h>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+using namespace Vpk;
+
+static void usage(const po::options_description &desc) {
+	std::cout <<
+		"Usage: vpkbench [OPTION...] BENCHMARK...\n"
+		"Microbenchmarks for libvpk.\n"
+		"\n"
+		"Benchmarks:\n"
+		"  crc32    CRC-32 kernels over a synthetic VPK file size distribution\n"
+		"  extract  ways to write files out of an archive, in a temporary\n"
+		"           directory (see TMPDIR)\n"
+		"  tree     read all files below --path with different numbers of\n"
+		"           threads, e.g. to see how a vpkfs mount scales\n"
+		"  stat     stat all files and dirs below --path with different\n"
+		"           numbers of threads\n"
+		"  generate write a synthetic VPK to --archive\n"
+		"  index    read the index of the archive into the node tree, lazily\n"
+		"           and into a compact tree\n"
+		"  lookup   look up every file of the archive by path\n"
+		"  process  check and extract the archive with different numbers of\n"
+		"           threads\n"
+		"  memory   heap used by the different index layouts\n"
+		"  skew     not a benchmark: checks small archives whose files have very\n"
+		"           different sizes with --threads and fails if any file isn't\n"
+		"           processed exactly once\n"
+		"  walk     not a benchmark: walks generated archives with TreeIterator\n"
+		"           and visit() and fails if a step differs from a recursive walk\n"
+		"\n"
+		"The index, lookup, process and memory benchmarks use --archive or, if it\n"
+		"isn't given, an archive generated with the --files ... --archives options\n"
+		"in a temporary directory.\n"
+		"\n" <<
+		desc;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Every benchmark reports its numbers here as well. --results writes them
+// as CSV, so runs can be compared by scripts.
+class Results {
+public:
+	void add(const std::string &benchmark, const std::string &name, const std::string &metric, double value) {
+		m_rows.push_back((boost::format("%s,%s,%s,%.10g\n") % benchmark % name % metric % value).str());
+	}
+
+	void write(const fs::path &path) const {
+		FileIO out(path, "wb");
+		out.write("benchmark,case,metric,value\n");
+		for (std::vector<std::string>::const_iterator row = m_rows.begin(); row != m_rows.end(); ++ row) {
+			out.write(*row);
+		}
+	}
+
+private:
+	std::vector<std::string> m_rows;
+};
+
+struct Sample {
+	std::string name;
+	std::vector<size_t> sizes;
+	size_t total;
+};
+
+static void makeSample(Sample &sample, const std::string &name, Random &random, size_t total, size_t fixedSize) {
+	sample.name  = name;
+	sample.total = 0;
+	sample.sizes.clear();
+
+	while (sample.total < total) {
+		size_t size = fixedSize ? fixedSize : VpkGenerator::vpkFileSize(random);
+		if (size > total - sample.total) size = total - sample.total;
+		sample.sizes.push_back(size);
+		sample.total += size;
+	}
+}
+
+static uint32_t boostCrc32(const char *buffer, size_t length) {
+	boost::crc_32_type crc;
+	crc.process_bytes(buffer, length);
+	return crc.checksum();
+}
+
+static uint32_t slice8Crc32(const char *buffer, size_t length) {
+	return ~Crc32::updateSlice8(0xFFFFFFFF, buffer, length);
+}
+
+static uint32_t pclmulCrc32(const char *buffer, size_t length) {
+	return ~Crc32::updatePclmul(0xFFFFFFFF, buffer, length);
+}
+
+typedef uint32_t (*Crc32Function)(const char *buffer, size_t length);
+
+// returns the best throughput in MB/s of all repetitions and xors all
+// checksums into sum so the results can be compared
+static double benchCrc32(Crc32Function func, const Sample &sample, const std::vector<char> &data, unsigned int repeat, uint32_t &sum) {
+	double best = 0;
+
+	for (unsigned int i = 0; i < repeat; ++ i) {
+		const char *ptr = &data[0];
+		uint32_t run = 0;
+		double start = now();
+
+		for (std::vector<size_t>::const_iterator size = sample.sizes.begin(); size != sample.sizes.end(); ++ size) {
+			run = (run << 1 | run >> 31) ^ func(ptr, *size);
+			ptr += *size;
+		}
+
+		double elapsed = now() - start;
+		double mbps = elapsed > 0 ? sample.total / elapsed / 1000000.0 : 0;
+		if (mbps > best) best = mbps;
+		sum = run;
+	}
+
+	return best;
+}
+
+static bool crc32Benchmark(size_t total, unsigned int repeat, uint64_t seed, Results &results) {
+	Random random(seed);
+	std::vector<char> data(total);
+	for (std::vector<char>::iterator it = data.begin(); it != data.end(); ++ it) {
+		*it = (char) random.next();
+	}
+
+	std::vector<Sample> samples(5);
+	makeSample(samples[0], "vpk",  random, total, 0);
+	makeSample(samples[1], "64",   random, total, 64);
+	makeSample(samples[2], "1K",   random, total, 1024);
+	makeSample(samples[3], "64K",  random, total, 64 * 1024);
+	makeSample(samples[4], "1M",   random, total, 1024 * 1024);
+
+	const char   *names[] = { "boost", "slice-by-8", "pclmul", "auto" };
+	Crc32Function funcs[] = { boostCrc32, slice8Crc32, pclmulCrc32, Crc32::compute };
+	size_t count = Crc32::hasPclmul() ? 4 : 2;
+	bool ok = true;
+
+	std::cout << "kernel used by libvpk: " << Crc32::kernelName() << "\n\n";
+	std::cout << boost::format("%-12s %-6s %10s %12s\n") % "kernel" % "sizes" % "files" % "MB/s";
+
+	for (std::vector<Sample>::const_iterator sample = samples.begin(); sample != samples.end(); ++ sample) {
+		uint32_t expected = 0;
+
+		for (size_t i = 0; i < count; ++ i) {
+			uint32_t sum = 0;
+			double mbps = benchCrc32(funcs[i], *sample, data, repeat, sum);
+
+			if (i == 0) {
+				expected = sum;
+			}
+			else if (sum != expected) {
+				std::cerr << "*** error: " << names[i] << " computed a different checksum than boost for sizes " << sample->name << "\n";
+				ok = false;
+			}
+
+			std::cout << boost::format("%-12s %-6s %10u %12.1f\n") % names[i] % sample->name % sample->sizes.size() % mbps;
+			results.add("crc32", std::string(names[i]) + "/" + sample->name, "MB/s", mbps);
+		}
+	}
+
+	return ok;
+}
+
+// Writes the files of sample from the archive fd into dir the way
+// Package::process() does in the given mode. Returns MB/s.
+enum ExtractMode {
+	EXTRACT_READ,  // read into memory, then write
+	EXTRACT_CHECK, // read into memory, check and write (-x)
+	EXTRACT_COPY   // copy in the kernel
+};
+
+static double extractRun(ExtractMode mode, int fd, const Sample &sample, const fs::path &dir) {
+	std::vector<char> buffer;
+	off_t offset = 0;
+	size_t index = 0;
+	double start = now();
+
+	{
+		FileDataHandlerFactory factory(dir.string(), mode == EXTRACT_CHECK);
+		for (std::vector<size_t>::const_iterator size = sample.sizes.begin(); size != sample.sizes.end(); ++ size, ++ index) {
+			// the checksum doesn't match, but finish() isn't called anyway
+			boost::scoped_ptr<FileDataHandler> handler(factory.create((boost::format("%06u") % index).str(), 0));
+
+			size_t copied = mode == EXTRACT_COPY ? handler->copy(fd, offset, *size) : 0;
+			if (copied < *size) {
+				size_t left = *size - copied;
+				if (buffer.size() < left) buffer.resize(left);
+				if (pread(fd, &buffer[0], left, offset + copied) != (ssize_t) left) {
+					throw IOError(errno);
+				}
+				handler->process(&buffer[0], left);
+			}
+			offset += *size;
+		}
+	}
+
+	double elapsed = now() - start;
+	fs::remove_all(dir);
+	fs::create_directory(dir);
+	return elapsed > 0 ? sample.total / elapsed / 1000000.0 : 0;
+}
+
+static bool extractBenchmark(size_t total, unsigned int repeat, uint64_t seed, Results &results) {
+	fs::path dir = fs::temp_directory_path() / fs::unique_path("vpkbench-%%%%-%%%%-%%%%");
+	fs::create_directory(dir);
+	fs::path archive = dir / "archive";
+	fs::path out     = dir / "out";
+	fs::create_directory(out);
+
+	bool ok = true;
+	int fd = -1;
+	try {
+		Random random(seed);
+		{
+			FileIO io(archive, "wb");
+			std::vector<char> chunk(1024 * 1024);
+			for (size_t left = total; left > 0; left -= std::min(left, chunk.size())) {
+				for (std::vector<char>::iterator it = chunk.begin(); it != chunk.end(); ++ it) {
+					*it = (char) random.next();
+				}
+				io.write(&chunk[0], std::min(left, chunk.size()));
+			}
+		}
+
+		fd = ::open(archive.string().c_str(), O_RDONLY);
+		if (fd < 0) throw IOError(errno);
+
+		std::vector<Sample> samples(3);
+		makeSample(samples[0], "vpk", random, total, 0);
+		makeSample(samples[1], "4K",  random, total, 4 * 1024);
+		makeSample(samples[2], "1M",  random, total, 1024 * 1024);
+
+		const char *names[] = { "read+write", "read+check", "copy_range" };
+		std::cout << "archive and output in " << dir.string() << "\n\n";
+		std::cout << boost::format("%-12s %-6s %10s %12s\n") % "mode" % "sizes" % "files" % "MB/s";
+
+		for (std::vector<Sample>::const_iterator sample = samples.begin(); sample != samples.end(); ++ sample) {
+			for (int mode = EXTRACT_READ; mode <= EXTRACT_COPY; ++ mode) {
+				double best = 0;
+				for (unsigned int i = 0; i < repeat; ++ i) {
+					best = std::max(best, extractRun((ExtractMode) mode, fd, *sample, out));
+				}
+				std::cout << boost::format("%-12s %-6s %10u %12.1f\n") % names[mode] % sample->name % sample->sizes.size() % best;
+				results.add("extract", std::string(names[mode]) + "/" + sample->name, "MB/s", best);
+			}
+		}
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		ok = false;
+	}
+
+	if (fd >= 0) ::close(fd);
+	fs::remove_all(dir);
+	return ok;
+}
+
+// collects the regular files and, if dirs is set, the dirs below path
+static bool collectFiles(const fs::path &path, bool dirs, std::vector<fs::path> &files) {
+	try {
+		for (fs::recursive_directory_iterator it(path), end; it != end; ++ it) {
+			fs::file_status status = it->status();
+			if (fs::is_regular_file(status) || (dirs && fs::is_directory(status))) {
+				files.push_back(it->path());
+			}
+		}
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		return false;
+	}
+
+	if (files.empty()) {
+		std::cerr << "*** error: no files found below " << path << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+struct TreeRun {
+	TreeRun(const std::vector<fs::path> &files) : files(files), next(0), bytes(0), failed(0) {}
+
+	const std::vector<fs::path> &files;
+	std::atomic<size_t>   next;
+	std::atomic<uint64_t> bytes;
+	std::atomic<size_t>   failed;
+};
+
+static void treeWorker(TreeRun *run) {
+	std::vector<char> buffer(128 * 1024);
+	uint64_t bytes = 0;
+
+	for (size_t i = run->next ++; i < run->files.size(); i = run->next ++) {
+		int fd = ::open(run->files[i].string().c_str(), O_RDONLY);
+		if (fd < 0) {
+			++ run->failed;
+			continue;
+		}
+
+		ssize_t count;
+		while ((count = ::read(fd, &buffer[0], buffer.size())) > 0) {
+			bytes += count;
+		}
+		if (count < 0) ++ run->failed;
+		::close(fd);
+	}
+
+	run->bytes += bytes;
+}
+
+static bool treeBenchmark(const fs::path &path, const std::vector<unsigned int> &threads, unsigned int repeat, Results &results) {
+	std::vector<fs::path> files;
+	if (!collectFiles(path, false, files)) return false;
+
+	bool ok = true;
+	std::cout << files.size() << " files below " << path.string() << "\n\n";
+	std::cout << boost::format("%-8s %12s %12s\n") % "threads" % "MB/s" % "files/s";
+
+	for (std::vector<unsigned int>::const_iterator count = threads.begin(); count != threads.end(); ++ count) {
+		double best = 0;
+		uint64_t bytes = 0;
+
+		for (unsigned int i = 0; i < repeat; ++ i) {
+			TreeRun run(files);
+			std::vector<std::thread> workers;
+			double start = now();
+
+			for (unsigned int j = 0; j < *count; ++ j) {
+				workers.push_back(std::thread(treeWorker, &run));
+			}
+			for (std::vector<std::thread>::iterator worker = workers.begin(); worker != workers.end(); ++ worker) {
+				worker->join();
+			}
+
+			double elapsed = now() - start;
+			if (run.failed > 0) {
+				std::cerr << "*** error: reading " << run.failed << " files failed\n";
+				ok = false;
+			}
+			if (i > 0 && run.bytes != bytes) {
+				std::cerr << "*** error: runs read different amounts of data\n";
+				ok = false;
+			}
+			bytes = run.bytes;
+			if (elapsed > 0) best = std::max(best, 1 / elapsed);
+		}
+
+		std::cout << boost::format("%-8u %12.1f %12.1f\n") % *count % (bytes * best / 1000000.0) % (files.size() * best);
+		std::string name = boost::lexical_cast<std::string>(*count);
+		results.add("tree", name, "MB/s", bytes * best / 1000000.0);
+		results.add("tree", name, "files/s", files.size() * best);
+	}
+
+	return ok;
+}
+
+// every path is stat()ed this many times per run, so a run takes long
+// enough to be measured even for small trees
+enum { STAT_ROUNDS = 16 };
+
+static void statWorker(TreeRun *run) {
+	size_t count = run->files.size() * STAT_ROUNDS;
+
+	for (size_t i = run->next ++; i < count; i = run->next ++) {
+		struct stat st;
+		if (::stat(run->files[i % run->files.size()].string().c_str(), &st) != 0) {
+			++ run->failed;
+		}
+	}
+}
+
+static bool statBenchmark(const fs::path &path, const std::vector<unsigned int> &threads, unsigned int repeat, Results &results) {
+	std::vector<fs::path> files;
+	if (!collectFiles(path, true, files)) return false;
+
+	bool ok = true;
+	std::cout << files.size() << " files and dirs below " << path.string() << "\n\n";
+	std::cout << boost::format("%-8s %12s\n") % "threads" % "stats/s";
+
+	for (std::vector<unsigned int>::const_iterator count = threads.begin(); count != threads.end(); ++ count) {
+		double best = 0;
+
+		for (unsigned int i = 0; i < repeat; ++ i) {
+			TreeRun run(files);
+			std::vector<std::thread> workers;
+			double start = now();
+
+			for (unsigned int j = 0; j < *count; ++ j) {
+				workers.push_back(std::thread(statWorker, &run));
+			}
+			for (std::vector<std::thread>::iterator worker = workers.begin(); worker != workers.end(); ++ worker) {
+				worker->join();
+			}
+
+			double elapsed = now() - start;
+			if (run.failed > 0) {
+				std::cerr << "*** error: " << run.failed << " stat calls failed\n";
+				ok = false;
+			}
+			if (elapsed > 0) best = std::max(best, 1 / elapsed);
+		}
+
+		std::cout << boost::format("%-8u %12.1f\n") % *count % (files.size() * STAT_ROUNDS * best);
+		results.add("stat", boost::lexical_cast<std::string>(*count), "stats/s", files.size() * STAT_ROUNDS * best);
+	}
+
+	return ok;
+}
+
+static bool generateBenchmark(const VpkGenerator::Options &options, const fs::path &archive, Results &results) {
+	try {
+		VpkGenerator generator(options);
+		double start = now();
+		generator.write(archive);
+		double elapsed = now() - start;
+
+		std::cout << boost::format("generated %u files with %.1f MB in %.2f s: %s\n\n") %
+			options.files % (generator.bytes() / 1000000.0) % elapsed % archive.string();
+		results.add("generate", "write", "s", elapsed);
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: generating " << archive << ": " << exc.what() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+static bool indexBenchmark(const fs::path &archive, unsigned int repeat, Results &results) {
+	const char *names[] = { "eager", "lazy", "compact" };
+	size_t files = 0;
+
+	std::cout << boost::format("%-8s %12s %12s\n") % "layout" % "ms" % "files/s";
+	try {
+		for (int mode = 0; mode < 3; ++ mode) {
+			double fastest = 0;
+
+			for (unsigned int i = 0; i < repeat; ++ i) {
+				double elapsed;
+				if (mode == 2) {
+					CompactTree tree;
+					double start = now();
+					tree.read(archive);
+					elapsed = now() - start;
+				}
+				else {
+					Package package;
+					package.setLazy(mode == 1);
+					double start = now();
+					package.read(archive);
+					elapsed = now() - start;
+					if (mode == 0) files = package.filecount();
+				}
+				if (i == 0 || elapsed < fastest) fastest = elapsed;
+			}
+
+			double rate = fastest > 0 ? files / fastest : 0;
+			std::cout << boost::format("%-8s %12.2f %12.1f\n") % names[mode] % (fastest * 1000) % rate;
+			results.add("index", names[mode], "ms", fastest * 1000);
+			results.add("index", names[mode], "files/s", rate);
+		}
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+static bool lookupBenchmark(const fs::path &archive, unsigned int repeat, uint64_t seed, Results &results) {
+	const char *names[] = { "tree", "index", "compact" };
+	bool ok = true;
+
+	try {
+		Package package;
+		package.read(archive);
+		CompactTree tree;
+		tree.read(archive);
+
+		ExtractionPlan plan;
+		plan.add(package);
+		std::vector<std::string> paths;
+		for (ExtractionPlan::Entries::const_iterator entry = plan.entries().begin(); entry != plan.entries().end(); ++ entry) {
+			paths.push_back(entry->path);
+		}
+		if (paths.empty()) {
+			std::cerr << "*** error: archive has no files: " << archive << std::endl;
+			return false;
+		}
+
+		// random order, so one lookup doesn't warm the caches for the next
+		Random random(seed);
+		for (size_t i = paths.size(); i > 1; -- i) {
+			std::swap(paths[i - 1], paths[random.next() % i]);
+		}
+
+		std::cout << paths.size() << " files\n\n";
+		std::cout << boost::format("%-8s %12s\n") % "lookup" % "ns";
+
+		for (int mode = 0; mode < 3; ++ mode) {
+			if (mode == 1) package.buildIndex();
+			double fastest = 0;
+			size_t missing = 0;
+
+			for (unsigned int i = 0; i < repeat; ++ i) {
+				missing = 0;
+				double start = now();
+				for (std::vector<std::string>::const_iterator path = paths.begin(); path != paths.end(); ++ path) {
+					if (mode == 2) {
+						CompactTree::Id id;
+						bool isdir;
+						if (!tree.get(path->c_str(), id, isdir)) ++ missing;
+					}
+					else if (!package.get(*path)) {
+						++ missing;
+					}
+				}
+				double elapsed = now() - start;
+				if (i == 0 || elapsed < fastest) fastest = elapsed;
+			}
+
+			if (missing > 0) {
+				std::cerr << "*** error: " << names[mode] << " lookup didn't find " << missing << " files\n";
+				ok = false;
+			}
+
+			double ns = fastest * 1e9 / paths.size();
+			std::cout << boost::format("%-8s %12.1f\n") % names[mode] % ns;
+			results.add("lookup", names[mode], "ns", ns);
+		}
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		return false;
+	}
+
+	return ok;
+}
+
+static bool processBenchmark(const fs::path &archive, const std::vector<unsigned int> &threads, unsigned int repeat, Results &results) {
+	const char *names[] = { "check", "extract" };
+	fs::path out = fs::temp_directory_path() / fs::unique_path("vpkbench-%%%%-%%%%-%%%%");
+	bool ok = true;
+
+	try {
+		Package package;
+		package.read(archive);
+
+		ExtractionPlan plan;
+		plan.add(package);
+		uint64_t bytes = 0;
+		for (ExtractionPlan::Entries::const_iterator entry = plan.entries().begin(); entry != plan.entries().end(); ++ entry) {
+			bytes += entry->file->preload.size() + entry->file->size;
+		}
+
+		std::cout << boost::format("%u files with %.1f MB, extracting to %s\n\n") %
+			plan.entries().size() % (bytes / 1000000.0) % out.string();
+		std::cout << boost::format("%-8s %-8s %12s %12s\n") % "mode" % "threads" % "MB/s" % "files/s";
+
+		for (int mode = 0; mode < 2; ++ mode) {
+			for (std::vector<unsigned int>::const_iterator count = threads.begin(); count != threads.end(); ++ count) {
+				double best = 0;
+
+				for (unsigned int i = 0; i < repeat; ++ i) {
+					double start = now();
+					if (mode == 0) {
+						package.check(*count);
+					}
+					else {
+						fs::create_directory(out);
+						package.extract(out.string(), false, *count);
+					}
+					double elapsed = now() - start;
+					fs::remove_all(out);
+					if (elapsed > 0) best = std::max(best, 1 / elapsed);
+				}
+
+				std::string name = (boost::format("%s/%u") % names[mode] % *count).str();
+				std::cout << boost::format("%-8s %-8u %12.1f %12.1f\n") % names[mode] % *count %
+					(bytes * best / 1000000.0) % (plan.entries().size() * best);
+				results.add("process", name, "MB/s", bytes * best / 1000000.0);
+				results.add("process", name, "files/s", plan.entries().size() * best);
+			}
+		}
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		ok = false;
+	}
+
+	fs::remove_all(out);
+	return ok;
+}
+
+// counts what Package::process() reports
+class CountingHandler : public Handler {
+public:
+	CountingHandler() : successes(0), errors(0) {}
+
+	void begin(const Package &) {}
+	void end() {}
+
+	bool filtererror(const std::exception &, const std::string &)  { ++ errors; return false; }
+	bool direrror(const std::exception &, const std::string &)     { ++ errors; return false; }
+	bool fileerror(const std::exception &, const std::string &)    { ++ errors; return false; }
+	bool archiveerror(const std::exception &, const std::string &) { ++ errors; return false; }
+	void extract(const std::string &) {}
+	void success(const std::string &) { ++ successes; }
+
+	size_t successes;
+	size_t errors;
+};
+
+// Archives with one file per *_NNN.vpk, so every file is an extent of its
+// own, and sizes between 1 byte and 200 kB. Often one extent holds more
+// than half of the bytes, which the splitting of the work has to handle.
+static bool skewCheck(const std::vector<unsigned int> &threads, unsigned int repeat, Results &results) {
+	const size_t counts[] = { 2, 3, 4, 6 };
+	fs::path tmpdir = fs::temp_directory_path() / fs::unique_path("vpkbench-%%%%-%%%%-%%%%");
+	size_t runs = 0, failed = 0;
+	bool ok = true;
+
+	try {
+		fs::create_directory(tmpdir);
+
+		for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++ i) {
+			for (uint64_t seed = 1; seed <= 16; ++ seed) {
+				VpkGenerator::Options options;
+				options.files    = counts[i];
+				options.sizes    = VpkGenerator::SIZES_UNIFORM;
+				options.minSize  = 1;
+				options.maxSize  = 200000;
+				options.depth    = 0;
+				options.archives = counts[i];
+				options.seed     = seed;
+
+				fs::path archive = tmpdir / (boost::format("skew%u_%u_dir.vpk") % counts[i] % seed).str();
+				VpkGenerator(options).write(archive);
+
+				CountingHandler handler;
+				Package package(&handler);
+				package.read(archive);
+
+				// with and without mapped archives
+				for (int mode = 0; mode < 2; ++ mode) {
+					package.setMapped(mode == 1);
+					for (std::vector<unsigned int>::const_iterator count = threads.begin(); count != threads.end(); ++ count) {
+						for (unsigned int round = 0; round < repeat * 10; ++ round) {
+							handler.successes = handler.errors = 0;
+							package.check(*count);
+							++ runs;
+							if (handler.successes != counts[i] || handler.errors != 0) {
+								std::cerr << boost::format("*** error: %s with %u threads: %u of %u files successful, %u errors\n") %
+									archive.filename().string() % *count % handler.successes % counts[i] % handler.errors;
+								++ failed;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		ok = false;
+	}
+
+	std::cout << boost::format("%u runs, %u failed\n") % runs % failed;
+	results.add("skew", "check", "failed", failed);
+
+	fs::remove_all(tmpdir);
+	return ok && failed == 0;
+}
+
+struct WalkStep {
+	WalkStep(int step, const std::string &path, const Node *node, size_t depth) :
+		step(step), path(path), node(node), depth(depth) {}
+
+	bool operator != (const WalkStep &other) const {
+		return step != other.step || path != other.path || node != other.node || depth != other.depth;
+	}
+
+	int         step;
+	std::string path;
+	const Node *node;
+	size_t      depth;
+};
+
+typedef std::vector<WalkStep> WalkSteps;
+
+// the same for all walks, so pruned and walked dirs are mixed at any depth
+static bool pruned(PathRef path) {
+	return path.size() % 3 == 0;
+}
+
+// the reference: a plain recursion that builds every path anew
+static void recursiveWalk(const Nodes &nodes, const std::string &path, size_t depth, bool prune, WalkSteps &steps) {
+	for (Nodes::const_iterator it = nodes.begin(); it != nodes.end(); ++ it) {
+		const Node *node = it->second.get();
+		std::string child = path.empty() ? node->name() : path + "/" + node->name();
+
+		if (node->type() == Node::DIR) {
+			steps.push_back(WalkStep(TreeIterator::ENTER, child, node, depth));
+			if (!prune || !pruned(child)) {
+				recursiveWalk(((const Dir*) node)->nodes(), child, depth + 1, prune, steps);
+				steps.push_back(WalkStep(TreeIterator::LEAVE, child, node, depth));
+			}
+		}
+		else {
+			steps.push_back(WalkStep(TreeIterator::FILE, child, node, depth));
+		}
+	}
+}
+
+static void iteratorWalk(const Dir &root, const std::string &prefix, bool prune, WalkSteps &steps) {
+	TreeIterator it(root, prefix);
+	while (it.next()) {
+		steps.push_back(WalkStep(it.step(), it.path().to_string(), &it.node(), it.depth()));
+		if (prune && it.step() == TreeIterator::ENTER && pruned(it.path())) {
+			it.prune();
+		}
+	}
+
+	// stays at the end
+	if (it.next() || it.depth() != 0) {
+		steps.push_back(WalkStep(-1, "", 0, 0));
+	}
+}
+
+class WalkVisitor : public Visitor {
+public:
+	WalkVisitor(bool prune, WalkSteps &steps) : m_prune(prune), m_depth(0), m_steps(steps) {}
+
+	bool enter(PathRef path, const Dir &dir) {
+		m_steps.push_back(WalkStep(TreeIterator::ENTER, path.to_string(), &dir, m_depth));
+		if (m_prune && pruned(path)) return false;
+		++ m_depth;
+		return true;
+	}
+
+	void leave(PathRef path, const Dir &dir) {
+		-- m_depth;
+		m_steps.push_back(WalkStep(TreeIterator::LEAVE, path.to_string(), &dir, m_depth));
+	}
+
+	void file(PathRef path, const File &file) {
+		m_steps.push_back(WalkStep(TreeIterator::FILE, path.to_string(), &file, m_depth));
+	}
+
+private:
+	bool       m_prune;
+	size_t     m_depth;
+	WalkSteps &m_steps;
+};
+
+// Generated archives of different shapes are walked with and without
+// pruning and with and without a prefix. The steps have to match the
+// recursive walk in order, path, node and depth.
+static bool walkCheck(Results &results) {
+	const unsigned int depths[]  = { 0, 1, 3, 6 };
+	const unsigned int fanouts[] = { 1, 3, 8 };
+	const char *prefixes[] = { "", "root", "root/sub" };
+	fs::path tmpdir = fs::temp_directory_path() / fs::unique_path("vpkbench-%%%%-%%%%-%%%%");
+	size_t walks = 0, failed = 0;
+	bool ok = true;
+
+	try {
+		fs::create_directory(tmpdir);
+
+		for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++ d) {
+			for (size_t f = 0; f < sizeof(fanouts) / sizeof(fanouts[0]); ++ f) {
+				for (uint64_t seed = 1; seed <= 4; ++ seed) {
+					VpkGenerator::Options options;
+					options.files    = 500;
+					options.sizes    = VpkGenerator::SIZES_UNIFORM;
+					options.minSize  = 0;
+					options.maxSize  = 100;
+					options.depth    = depths[d];
+					options.fanout   = fanouts[f];
+					options.archives = 0;
+					options.seed     = seed;
+
+					fs::path archive = tmpdir / (boost::format("walk%u_%u_%u_dir.vpk") % depths[d] % fanouts[f] % seed).str();
+					VpkGenerator(options).write(archive);
+
+					Package package;
+					package.read(archive);
+
+					for (size_t p = 0; p < sizeof(prefixes) / sizeof(prefixes[0]); ++ p) {
+						for (int prune = 0; prune < 2; ++ prune) {
+							WalkSteps expected, iterated, visited;
+							recursiveWalk(package.nodes(), prefixes[p], 0, prune, expected);
+							iteratorWalk(package, prefixes[p], prune, iterated);
+							WalkVisitor visitor(prune, visited);
+							visit(package, visitor, prefixes[p]);
+
+							const WalkSteps *walked[] = { &iterated, &visited };
+							const char *names[] = { "TreeIterator", "visit()" };
+							for (size_t w = 0; w < 2; ++ w) {
+								const WalkSteps &steps = *walked[w];
+								size_t i = 0;
+								while (i < steps.size() && i < expected.size() && !(steps[i] != expected[i])) ++ i;
+								++ walks;
+								if (i < steps.size() || i < expected.size()) {
+									std::cerr << boost::format("*** error: %s of %s (prefix \"%s\"%s): step %u of %u differs\n") %
+										names[w] % archive.filename().string() % prefixes[p] %
+										(prune ? ", pruned" : "") % i % expected.size();
+									++ failed;
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		ok = false;
+	}
+
+	std::cout << boost::format("%u walks, %u failed\n") % walks % failed;
+	results.add("walk", "check", "failed", failed);
+
+	fs::remove_all(tmpdir);
+	return ok && failed == 0;
+}
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#	define VPK_HAVE_MALLINFO2
+#endif
+
+// bytes allocated on the heap, including chunks that malloc mapped
+static size_t heapUsage() {
+#ifdef VPK_HAVE_MALLINFO2
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+#else
+	return 0;
+#endif
+}
+
+static bool memoryBenchmark(const fs::path &archive, Results &results) {
+#ifndef VPK_HAVE_MALLINFO2
+	(void) archive;
+	(void) results;
+	std::cerr << "*** error: heap usage can't be measured on this platform\n";
+	return false;
+#else
+	const char *names[] = { "tree", "lazy", "index", "compact" };
+	size_t usage[4];
+	size_t files;
+
+	try {
+		size_t before = heapUsage();
+		boost::scoped_ptr<Package> package(new Package());
+		package->read(archive);
+		usage[0] = heapUsage() - before;
+		files = package->filecount();
+
+		before = heapUsage();
+		package->buildIndex();
+		usage[2] = heapUsage() - before;
+		package.reset();
+
+		before = heapUsage();
+		package.reset(new Package());
+		package->setLazy(true);
+		package->read(archive);
+		usage[1] = heapUsage() - before;
+		package.reset();
+
+		before = heapUsage();
+		boost::scoped_ptr<CompactTree> tree(new CompactTree());
+		tree->read(archive);
+		usage[3] = heapUsage() - before;
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		return false;
+	}
+
+	std::cout << files << " files\n\n";
+	std::cout << boost::format("%-8s %14s %12s\n") % "layout" % "bytes" % "bytes/file";
+	for (int i = 0; i < 4; ++ i) {
+		double perFile = files > 0 ? (double) usage[i] / files : 0;
+		std::cout << boost::format("%-8s %14u %12.1f\n") % names[i] % usage[i] % perFile;
+		results.add("memory", names[i], "bytes", usage[i]);
+		results.add("memory", names[i], "bytes/file", perFile);
+	}
+
+	return true;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+	po::options_description desc("Options");
+	desc.add_options()
+		("help,h",    "print help message")
+		("version,v", "print version")
+		("size,s",    po::value<size_t>()->default_value(256), "amount of data per run in MiB")
+		("repeat,r",  po::value<unsigned int>()->default_value(5), "number of runs, the best is reported")
+		("seed",      po::value<uint64_t>()->default_value(1), "seed of the data generator")
+		("path",      po::value<std::string>()->default_value("."), "directory used by the tree and stat benchmarks")
+		("threads",   po::value<std::string>()->default_value("1,2,4,8"), "comma separated thread counts of the tree, stat and process benchmarks")
+		("archive",   po::value<std::string>(), "*_dir.vpk written by the generate and used by the index, lookup, process and memory benchmarks")
+		("files",     po::value<size_t>()->default_value(100000), "number of files of a generated archive")
+		("sizes",     po::value<std::string>()->default_value("vpk"), "file sizes of a generated archive in bytes:\n"
+		              "    vpk      a mix like in the Source engine VPKs\n"
+		              "    SIZE     all files have the same size\n"
+		              "    MIN-MAX  evenly distributed")
+		("preload",   po::value<size_t>()->default_value(0), "maximum preload data per file of a generated archive")
+		("depth",     po::value<unsigned int>()->default_value(3), "maximum directory depth of a generated archive")
+		("fanout",    po::value<unsigned int>()->default_value(8), "subdirectories per directory of a generated archive")
+		("archives",  po::value<unsigned int>()->default_value(4), "number of *_NNN.vpk files of a generated archive, with 0 all data is in the *_dir.vpk file")
+		("results",   po::value<std::string>(), "write all results to this file as CSV");
+
+	po::options_description hidden;
+	hidden.add_options()
+		("benchmark", po::value< std::vector<std::string> >(), "benchmarks to run");
+
+	po::options_description opts;
+	opts.add(desc).add(hidden);
+
+	po::positional_options_description pos;
+	pos.add("benchmark", -1);
+
+	po::variables_map vm;
+	try {
+		po::store(po::command_line_parser(argc, argv).options(opts).positional(pos).run(), vm);
+		po::notify(vm);
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		usage(desc);
+		return 1;
+	}
+
+	if (vm.count("help") || vm.count("benchmark") < 1) {
+		usage(desc);
+		return 0;
+	}
+	else if (vm.count("version")) {
+		std::cout << "vpkbench version " << VERSION << std::endl;
+		return 0;
+	}
+
+	size_t       size   = vm["size"].as<size_t>() * 1024 * 1024;
+	unsigned int repeat = vm["repeat"].as<unsigned int>();
+	uint64_t     seed   = vm["seed"].as<uint64_t>();
+	std::vector<std::string> benchmarks = vm["benchmark"].as< std::vector<std::string> >();
+	std::vector<unsigned int> threads;
+	bool ok = true;
+
+	std::vector<std::string> counts;
+	boost::split(counts, vm["threads"].as<std::string>(), boost::is_any_of(","));
+	try {
+		for (std::vector<std::string>::const_iterator it = counts.begin(); it != counts.end(); ++ it) {
+			threads.push_back(boost::lexical_cast<unsigned int>(*it));
+			if (threads.back() == 0) throw boost::bad_lexical_cast();
+		}
+	}
+	catch (const boost::bad_lexical_cast&) {
+		std::cerr << "*** error: illegal thread counts: \"" << vm["threads"].as<std::string>() << "\"\n";
+		return 1;
+	}
+
+	if (size == 0 || repeat == 0) {
+		std::cerr << "*** error: size and repeat have to be greater than zero\n";
+		return 1;
+	}
+
+	VpkGenerator::Options options;
+	options.files    = vm["files"].as<size_t>();
+	options.preload  = vm["preload"].as<size_t>();
+	options.depth    = vm["depth"].as<unsigned int>();
+	options.fanout   = vm["fanout"].as<unsigned int>();
+	options.archives = vm["archives"].as<unsigned int>();
+	options.seed     = seed;
+
+	if (!options.parseSizes(vm["sizes"].as<std::string>())) {
+		std::cerr << "*** error: illegal file sizes: \"" << vm["sizes"].as<std::string>() << "\"\n";
+		return 1;
+	}
+
+	if (options.preload > 0xffff || options.fanout == 0 || options.archives > 999) {
+		std::cerr << "*** error: preload has to be at most 65535, fanout greater than zero and archives at most 999\n";
+		return 1;
+	}
+
+	for (std::vector<std::string>::const_iterator it = benchmarks.begin(); it != benchmarks.end(); ++ it) {
+		if (*it != "crc32" && *it != "extract" && *it != "tree" && *it != "stat" && *it != "generate" &&
+				*it != "index" && *it != "lookup" && *it != "process" && *it != "memory" && *it != "skew" &&
+				*it != "walk") {
+			std::cerr << "*** error: unknown benchmark: \"" << *it << "\"\n";
+			return 1;
+		}
+		else if (*it == "generate" && vm.count("archive") == 0) {
+			std::cerr << "*** error: the generate benchmark needs --archive\n";
+			return 1;
+		}
+	}
+
+	fs::path archive = vm.count("archive") > 0 ? fs::path(vm["archive"].as<std::string>()) : fs::path();
+	fs::path tmpdir;
+	Results results;
+
+	for (std::vector<std::string>::const_iterator it = benchmarks.begin(); it != benchmarks.end(); ++ it) {
+		if (*it == "crc32") {
+			ok = crc32Benchmark(size, repeat, seed, results) && ok;
+		}
+		else if (*it == "extract") {
+			ok = extractBenchmark(size, repeat, seed, results) && ok;
+		}
+		else if (*it == "tree") {
+			ok = treeBenchmark(vm["path"].as<std::string>(), threads, repeat, results) && ok;
+		}
+		else if (*it == "stat") {
+			ok = statBenchmark(vm["path"].as<std::string>(), threads, repeat, results) && ok;
+		}
+		else if (*it == "generate") {
+			ok = generateBenchmark(options, archive, results) && ok;
+		}
+		else if (*it == "skew") {
+			ok = skewCheck(threads, repeat, results) && ok;
+		}
+		else if (*it == "walk") {
+			ok = walkCheck(results) && ok;
+		}
+		else {
+			if (archive.empty()) {
+				tmpdir  = fs::temp_directory_path() / fs::unique_path("vpkbench-%%%%-%%%%-%%%%");
+				archive = tmpdir / "bench_dir.vpk";
+				fs::create_directory(tmpdir);
+				if (!generateBenchmark(options, archive, results)) {
+					ok = false;
+					break;
+				}
+			}
+
+			if (*it == "index") {
+				ok = indexBenchmark(archive, repeat, results) && ok;
+			}
+			else if (*it == "lookup") {
+				ok = lookupBenchmark(archive, repeat, seed, results) && ok;
+			}
+			else if (*it == "process") {
+				ok = processBenchmark(archive, threads, repeat, results) && ok;
+			}
+			else {
+				ok = memoryBenchmark(archive, results) && ok;
+			}
+		}
+	}
+
+	if (!tmpdir.empty()) {
+		fs::remove_all(tmpdir);
+	}
+
+	if (vm.count("results") > 0) {
+		try {
+			results.write(vm["results"].as<std::string>());
+		}
+		catch (const std::exception &exc) {
+			std::cerr << "*** error: writing results: " << exc.what() << std::endl;
+			ok = false;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <string.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/predicate.hpp>
+
+#include <vpk/vpk_generator.h>
+#include <vpk/header.h>
+#include <vpk/file_io.h>
+#include <vpk/crc32.h>
+#include <vpk/exception.h>
+
+namespace fs = boost::filesystem;
+
+static const char *extensions[] = { "vmt", "vtf", "mdl", "vvd", "vtx", "phy", "wav", "txt", "res", "pcf" };
+
+enum {
+	EXTENSIONS = sizeof(extensions) / sizeof(extensions[0]),
+	DIR_INDEX  = 0x7fff // the data is stored in the *_dir.vpk file
+};
+
+namespace {
+	struct Entry {
+		std::string       name;
+		uint32_t          crc32;
+		uint16_t          index;
+		uint32_t          offset;
+		uint32_t          size;
+		std::vector<char> preload;
+	};
+
+	// type -> dir path -> files, the layout of the index
+	typedef std::map<std::string, std::map<std::string, std::vector<Entry> > > Index;
+}
+
+static void fill(Vpk::Random &random, std::vector<char> &data) {
+	for (size_t i = 0; i < data.size(); i += 8) {
+		uint64_t value = random.next();
+		memcpy(&data[i], &value, std::min((size_t) 8, data.size() - i));
+	}
+}
+
+static fs::path partPath(const std::string &prefix, unsigned int part) {
+	return (boost::format("%s_%03u.vpk") % prefix % part).str();
+}
+
+bool Vpk::VpkGenerator::Options::parseSizes(const std::string &spec) {
+	if (spec == "vpk") {
+		sizes = SIZES_VPK;
+		return true;
+	}
+
+	try {
+		size_t dash = spec.find('-');
+		if (dash == std::string::npos) {
+			sizes   = SIZES_FIXED;
+			minSize = maxSize = boost::lexical_cast<size_t>(spec);
+		}
+		else {
+			sizes   = SIZES_UNIFORM;
+			minSize = boost::lexical_cast<size_t>(spec.substr(0, dash));
+			maxSize = boost::lexical_cast<size_t>(spec.substr(dash + 1));
+		}
+	}
+	catch (const boost::bad_lexical_cast&) {
+		return false;
+	}
+
+	return minSize <= maxSize;
+}
+
+size_t Vpk::VpkGenerator::vpkFileSize(Random &random) {
+	unsigned int bucket = random.next() % 100;
+
+	if (bucket < 45) return random.range(16, 1024);
+	if (bucket < 75) return random.range(1024, 16 * 1024);
+	if (bucket < 93) return random.range(16 * 1024, 256 * 1024);
+	if (bucket < 99) return random.range(256 * 1024, 2 * 1024 * 1024);
+	return random.range(2 * 1024 * 1024, 16 * 1024 * 1024);
+}
+
+size_t Vpk::VpkGenerator::fileSize(Random &random) const {
+	switch (m_options.sizes) {
+	case SIZES_FIXED:   return m_options.minSize;
+	case SIZES_UNIFORM: return random.range(m_options.minSize, m_options.maxSize);
+	default:            return vpkFileSize(random);
+	}
+}
+
+void Vpk::VpkGenerator::write(const fs::path &dirfile) {
+	std::string name = dirfile.filename().string();
+	if (!boost::algorithm::ends_with(name, "_dir.vpk")) {
+		throw Exception("archive name has to end in \"_dir.vpk\"");
+	}
+	std::string prefix = (dirfile.parent_path() / name.substr(0, name.size() - 8)).string();
+
+	Random random(m_options.seed);
+	Index index;
+	std::vector<char> data;
+	std::vector<char> dirdata;
+	boost::scoped_ptr<FileIO> archive;
+	unsigned int part = 0;
+	uint64_t archiveSize = 0;
+	m_bytes = 0;
+
+	for (size_t i = 0; i < m_options.files; ++ i) {
+		std::string dir;
+		unsigned int depth = m_options.fanout > 0 ? random.range(0, m_options.depth) : 0;
+		for (unsigned int level = 0; level < depth; ++ level) {
+			if (!dir.empty()) dir += '/';
+			dir += 'd';
+			dir += boost::lexical_cast<std::string>(random.range(0, m_options.fanout - 1));
+		}
+		// the root dir is spelled " " in the index
+		if (dir.empty()) dir = " ";
+
+		std::vector<Entry> &files = index[extensions[random.next() % EXTENSIONS]][dir];
+		files.push_back(Entry());
+		Entry &entry = files.back();
+
+		size_t size    = fileSize(random);
+		size_t preload = m_options.preload > 0 ? std::min(size, random.range(0, m_options.preload)) : 0;
+		data.resize(size);
+		fill(random, data);
+
+		entry.name  = (boost::format("f%07u") % i).str();
+		entry.crc32 = size > 0 ? Crc32::compute(&data[0], size) : 0;
+		entry.size  = size - preload;
+		entry.preload.assign(data.begin(), data.begin() + preload);
+
+		if (m_options.archives == 0) {
+			if (dirdata.size() + entry.size > 0xffffffff) {
+				throw Exception("data doesn't fit into the _dir.vpk file, use more archives");
+			}
+			entry.index  = DIR_INDEX;
+			entry.offset = dirdata.size();
+			dirdata.insert(dirdata.end(), data.begin() + preload, data.end());
+		}
+		else {
+			unsigned int want = (uint64_t) i * m_options.archives / m_options.files;
+			while (!archive || part < want) {
+				if (archive) ++ part;
+				archive.reset(new FileIO(partPath(prefix, part), "wb"));
+				archiveSize = 0;
+			}
+
+			if (archiveSize + entry.size > 0xffffffff) {
+				throw Exception("archive would exceed 4 GiB, use more archives");
+			}
+			entry.index  = part;
+			entry.offset = archiveSize;
+			if (entry.size > 0) {
+				archive->write(&data[preload], entry.size);
+			}
+			archiveSize += entry.size;
+		}
+
+		m_bytes += size;
+	}
+
+	// parts without any files still exist
+	for (unsigned int next = archive ? part + 1 : 0; next < m_options.archives; ++ next) {
+		FileIO empty(partPath(prefix, next), "wb");
+	}
+
+	FileIO io(dirfile, "wb");
+	io.writeLU32(Header::MAGIC);
+	io.writeLU32(1);
+	io.writeLU32(0); // index size, written below
+
+	off_t begin = io.tell();
+	for (Index::const_iterator type = index.begin(); type != index.end(); ++ type) {
+		io.writeAsciiZ(type->first);
+		for (Index::mapped_type::const_iterator dir = type->second.begin(); dir != type->second.end(); ++ dir) {
+			io.writeAsciiZ(dir->first);
+			for (std::vector<Entry>::const_iterator file = dir->second.begin(); file != dir->second.end(); ++ file) {
+				io.writeAsciiZ(file->name);
+				io.writeLU32(file->crc32);
+				io.writeLU16(file->preload.size());
+				io.writeLU16(file->index);
+				io.writeLU32(file->offset);
+				io.writeLU32(file->size);
+				io.writeLU16(0xffff);
+				if (!file->preload.empty()) {
+					io.write(&file->preload[0], file->preload.size());
+				}
+			}
+			io.writeU8(0);
+		}
+		io.writeU8(0);
+	}
+	io.writeU8(0);
+
+	off_t end = io.tell();
+	io.seek(8, FileIO::SET);
+	io.writeLU32(end - begin);
+	io.seek(end, FileIO::SET);
+
+	if (!dirdata.empty()) {
+		io.write(&dirdata[0], dirdata.size());
+	}
+}
@@ -0,0 +1,94 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_CONTENT_CACHE_H
+#define VPK_CONTENT_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <list>
+#include <mutex>
+#include <vector>
+
+#include <boost/unordered_map.hpp>
+
+#include <vpk/file.h>
+
+namespace Vpk {
+	// Caches the archived data of small files for vpkfs.
+	//
+	// Most files in a VPK are tiny and programs like game servers read the
+	// same ones over and over. The first read of such a file reads all of
+	// it from the archive, later reads are served from memory.
+	//
+	// All files share one memory budget and the least recently used files
+	// are dropped first. All methods are thread safe.
+	class ContentCache {
+	public:
+		enum {
+			DEFAULT_MAX_FILE_SIZE = 64 * 1024
+		};
+
+		ContentCache(size_t capacity, size_t maxFileSize = DEFAULT_MAX_FILE_SIZE);
+
+		// whether read() can be used for file
+		bool cacheable(const File *file) const {
+			return file->size > 0 && file->size <= m_maxFileSize && file->size <= m_capacity;
+		}
+
+		// Reads size bytes at offset of the archived data of file (its
+		// archive opened as fd) into buf. Returns the number of bytes
+		// read, which is less than size only at the end of the file, or
+		// -errno.
+		ssize_t read(const File *file, int fd, char *buf, size_t size, off_t offset);
+
+		void clear();
+
+		size_t capacity()    const { return m_capacity; }
+		size_t maxFileSize() const { return m_maxFileSize; }
+		size_t size()        const;
+
+		// reads served from memory and files read from the archives
+		uint64_t hits()   const;
+		uint64_t misses() const;
+
+	private:
+		struct Entry {
+			const File       *file;
+			std::vector<char> data;
+		};
+
+		// most recently used first
+		typedef std::list<Entry> Entries;
+		typedef boost::unordered_map<const File*, Entries::iterator> Lookup;
+
+		void insert(Entry &entry);
+
+		size_t             m_capacity;
+		size_t             m_maxFileSize;
+		size_t             m_size;
+		uint64_t           m_hits;
+		uint64_t           m_misses;
+		Entries            m_entries;
+		Lookup             m_lookup;
+		mutable std::mutex m_mutex;
+	};
+}
+
+#endif
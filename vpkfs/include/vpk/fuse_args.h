@@ -72,6 +72,7 @@ namespace Vpk {
 		int argc() const { return m_args.argc; }
 		char const* const* argv() const { return m_args.argv; }
 		char** argv() { return m_args.argv; }
+		struct fuse_args *args() { return &m_args; }
 	
 	private:
 		struct fuse_args m_args;
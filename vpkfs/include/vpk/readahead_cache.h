@@ -0,0 +1,102 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef VPK_READAHEAD_CACHE_H
+#define VPK_READAHEAD_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <list>
+#include <mutex>
+#include <vector>
+#include <utility>
+
+#include <boost/unordered_map.hpp>
+
+namespace Vpk {
+	// Caches aligned windows of archive data for vpkfs.
+	//
+	// Small files stored next to each other in an archive are often read
+	// one after the other (copying or grepping a directory), and FUSE
+	// splits reads into small requests. When a read starts about where the
+	// last read of the same archive ended, the whole window around it is
+	// read at once and the following reads are served from memory. Other
+	// reads go straight to the archive and aren't cached.
+	//
+	// The windows of all archives share one memory budget and the least
+	// recently used windows are dropped first. All methods are thread safe.
+	class ReadaheadCache {
+	public:
+		enum {
+			DEFAULT_CAPACITY    = 32 * 1024 * 1024,
+			DEFAULT_WINDOW_SIZE = 256 * 1024
+		};
+
+		ReadaheadCache(size_t capacity = DEFAULT_CAPACITY, size_t windowSize = DEFAULT_WINDOW_SIZE);
+
+		// Reads size bytes at offset of the archive index (opened as fd)
+		// into buf. Returns the number of bytes read, which is less than
+		// size only at the end of the archive, or -errno.
+		ssize_t read(uint16_t index, int fd, char *buf, size_t size, off_t offset);
+
+		// Whether read() would serve the range from memory or read the
+		// windows around it. If not the caller can read (or splice) the
+		// range itself, it is remembered like a read that missed.
+		bool wants(uint16_t index, size_t size, off_t offset);
+
+		void clear();
+
+		size_t capacity()   const { return m_capacity; }
+		size_t windowSize() const { return m_windowSize; }
+		size_t size()       const;
+
+		// reads served from memory and windows read from the archives
+		uint64_t hits()   const;
+		uint64_t misses() const;
+
+	private:
+		typedef std::pair<uint16_t, uint64_t> Key; // archive index, window number
+
+		struct Window {
+			Key               key;
+			std::vector<char> data; // shorter than a window at the end of the archive
+		};
+
+		// most recently used first
+		typedef std::list<Window> Windows;
+		typedef boost::unordered_map<Key, Windows::iterator> Lookup;
+		typedef boost::unordered_map<uint16_t, off_t> Positions;
+
+		size_t cached(uint16_t index, char *buf, size_t size, off_t offset);
+		bool   sequential(uint16_t index, off_t pos) const;
+		void   insert(Window &window);
+
+		size_t             m_capacity;
+		size_t             m_windowSize;
+		size_t             m_size;
+		uint64_t           m_hits;
+		uint64_t           m_misses;
+		Windows            m_windows;
+		Lookup             m_lookup;
+		Positions          m_next; // where the last read of each archive ended
+		mutable std::mutex m_mutex;
+	};
+}
+
+#endif
@@ -20,22 +20,37 @@
 #define VPK_FUSE_H
 
 #include <stdio.h>
+#include <pthread.h>
 #include <sys/statvfs.h>
 
 #include <vector>
+#include <memory>
+#include <atomic>
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/unordered_set.hpp>
-#include <boost/unordered_map.hpp>
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 
 #include <vpk/console_handler.h>
 #include <vpk/package.h>
+#include <vpk/archive_set.h>
+#include <vpk/readahead_cache.h>
+#include <vpk/content_cache.h>
 #include <vpk/fuse_args.h>
 
 namespace Vpk {
 	class Vpkfs {
 	public:
+		// with -o readahead open() asks for at most this much of a file
+		enum { READAHEAD_SIZE = 1024 * 1024 };
+
+		// The archive can't change while it is mounted, so with -o immutable
+		// and -o lowlevel the kernel may keep entries and attributes this
+		// many seconds.
+		enum { CACHE_TIMEOUT = 24 * 60 * 60 };
+
 		Vpkfs(int argc, char *argv[], bool allocated=false);
 		Vpkfs(
 			const std::string &archive,
@@ -61,28 +76,142 @@ namespace Vpk {
 		int listxattr(const char *path, char *buf, size_t size);
 		int getxattr(const char *path, const char *name, char *buf, size_t size);
 
+		// FUSE low-level API, see vpkfs_lowlevel.cpp
+		void lookup(fuse_req_t req, fuse_ino_t parent, const char *name);
+		void getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+		void opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+		void readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		             struct fuse_file_info *fi);
+		void open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi);
+		void read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+		          struct fuse_file_info *fi);
+		void statfs(fuse_req_t req, fuse_ino_t ino);
+		void listxattr(fuse_req_t req, fuse_ino_t ino, size_t size);
+		void getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size);
+
 		const std::string &archive()    const { return m_archive; }
 		const std::string &mountpoint() const { return m_mountpoint; }
 
+		// read the index through the IndexCache, has to be set before init()
+		void setIndexCache(bool indexCache) { m_indexCache = indexCache; }
+		bool indexCache() const { return m_indexCache; }
+
+		// decode the files of a dir on first access, has to be set before init()
+		void setLazy(bool lazy) { m_lazy = lazy; }
+		bool lazy() const { return m_lazy; }
+
+		// start reading files when they are opened, has to be set before init()
+		void setReadahead(bool readahead) { m_readahead = readahead; }
+		bool readahead() const { return m_readahead; }
+
+		// Every FUSE worker thread opens the archives itself, so the threads
+		// don't contend on the reference count of shared open files. Has to
+		// be set before init().
+		void setThreadFds(bool threadFds) { m_threadFds = threadFds; }
+		bool threadFds() const { return m_threadFds; }
+
+		// memory for the ReadaheadCache, 0 disables it, has to be set before init()
+		void setReadaheadCacheSize(size_t size) { m_readaheadCacheSize = size; }
+		size_t readaheadCacheSize() const { return m_readaheadCacheSize; }
+
+		// memory for the ContentCache, 0 disables it, has to be set before init()
+		void setContentCacheSize(size_t size) { m_contentCacheSize = size; }
+		size_t contentCacheSize() const { return m_contentCacheSize; }
+
+		// Let the kernel cache entries and attributes. Has to be set
+		// before run().
+		void setImmutable(bool immutable) { m_immutable = immutable; }
+		bool immutable() const { return m_immutable; }
+
+		// Use the FUSE low-level API, which implies immutable(). All nodes
+		// are numbered in init(), so -o lazy has no effect. Has to be set
+		// before run().
+		void setLowlevel(bool lowlevel) { m_lowlevel = lowlevel; }
+		bool lowlevel() const { return m_lowlevel; }
+
+		// Map the archives and copy from the mappings instead of reading,
+		// see ArchiveSet. Has to be set before init().
+		void setMapped(bool mapped) { m_mapped = mapped; }
+		bool mapped() const { return m_mapped; }
+
 		void clear();
 	
 	private:
 		void setup();
-		void statfs(const Node *node);
+		void setupLowlevel();
+		int runLowlevel();
+		void statfs(const Dir &root);
+		void statArchives();
+		void number(fuse_ino_t ino);
+		int stat(const Node *node, struct stat *stbuf);
+		int open(Node *node, struct fuse_file_info *fi);
+		int listxattr(const Node *node, char *buf, size_t size);
+		int getxattr(const Node *node, const char *name, char *buf, size_t size);
+		ssize_t readArchive(uint16_t index, char *buf, size_t size, off_t offset);
+		int archiveFd(uint16_t index) const;
 
-		typedef boost::unordered_map<uint16_t,int> Archives;
+		// archive index -> fd, -1 for unused indices. The _dir.vpk file
+		// (index 0x7fff) isn't in it, its fd is m_dirFd.
+		typedef std::vector<int> Archives;
 		typedef boost::unordered_set<uint16_t> Indices;
 
+		// The children of a dir have consecutive inode numbers, so readdir
+		// can go straight to any offset.
+		struct Inode {
+			Inode(Node *node, fuse_ino_t parent) : node(node), parent(parent), children(0) {}
+
+			Node      *node;
+			fuse_ino_t parent;
+			fuse_ino_t children;
+		};
+		typedef std::vector<Inode> Inodes;
+
+		// What stat() takes from the archives: one template per archive
+		// and one for dirs and inlined files. Never changed once published,
+		// a refresh publishes a new one.
+		struct StatTemplates {
+			std::vector<struct stat> archives;
+			struct stat              dir;
+		};
+
+		const Inode *inode(fuse_ino_t ino) const {
+			return ino > 0 && ino < m_inodes.size() ? &m_inodes[ino] : 0;
+		}
+
 		FuseArgs               m_args;
 		int                    m_flags;
+		bool                   m_indexCache;
+		bool                   m_lazy;
+		bool                   m_readahead;
+		bool                   m_threadFds;
+		bool                   m_immutable;
+		bool                   m_lowlevel;
+		bool                   m_mapped;
+		size_t                 m_readaheadCacheSize;
+		size_t                 m_contentCacheSize;
 		std::string            m_archive;
 		std::string            m_mountpoint;
 		ConsoleHandler         m_handler;
 		Package                m_package;
+		// only written by init() and clear(), FUSE threads just read them
 		Archives               m_archives;
+		std::vector<std::string> m_archivePaths;
+		int                    m_dirFd;
 		fsfilcnt_t             m_files;
+		// the archive indices of all files with data besides preload data
 		Indices                m_indices;
+		// index 0 is unused, FUSE_ROOT_ID is the package
+		Inodes                 m_inodes;
+		// only accessed with std::atomic_load() and std::atomic_store(),
+		// a reader keeps the templates it loaded alive
+		std::shared_ptr<const StatTemplates> m_stats;
+		pthread_key_t          m_threadFdsKey;
+		bool                   m_threadFdsKeyCreated;
+		boost::scoped_ptr<ArchiveSet> m_mappedArchives;
+		boost::scoped_ptr<ReadaheadCache> m_readaheadCache;
+		boost::scoped_ptr<ContentCache> m_contentCache;
 		struct fuse_operations m_operations;
+		struct fuse_lowlevel_ops m_lowlevelOperations;
 	};
 }
 
@@ -0,0 +1,123 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <vpk/content_cache.h>
+
+Vpk::ContentCache::ContentCache(size_t capacity, size_t maxFileSize)
+		: m_capacity(capacity), m_maxFileSize(maxFileSize),
+		  m_size(0), m_hits(0), m_misses(0) {}
+
+static size_t vpk_copy_content(const std::vector<char> &data, char *buf, size_t size, off_t offset) {
+	if ((size_t) offset >= data.size()) return 0;
+
+	size_t length = std::min(size, data.size() - offset);
+	memcpy(buf, &data[offset], length);
+	return length;
+}
+
+ssize_t Vpk::ContentCache::read(const File *file, int fd, char *buf, size_t size, off_t offset) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Lookup::iterator found = m_lookup.find(file);
+		if (found != m_lookup.end()) {
+			Entries::iterator entry = found->second;
+			m_entries.splice(m_entries.begin(), m_entries, entry);
+			++ m_hits;
+			return vpk_copy_content(entry->data, buf, size, offset);
+		}
+	}
+
+	Entry entry;
+	entry.file = file;
+	entry.data.resize(file->size);
+
+	size_t count = 0;
+	while (count < entry.data.size()) {
+		ssize_t chunk = pread(fd, &entry.data[count], entry.data.size() - count, file->offset + count);
+		if (chunk < 0) {
+			if (errno == EINTR) continue;
+			return -errno;
+		}
+		if (chunk == 0) break;
+		count += chunk;
+	}
+
+	if (count < entry.data.size()) {
+		// truncated archive, don't remember that
+		entry.data.resize(count);
+		return vpk_copy_content(entry.data, buf, size, offset);
+	}
+
+	size_t length = vpk_copy_content(entry.data, buf, size, offset);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++ m_misses;
+	insert(entry);
+
+	return length;
+}
+
+// m_mutex has to be held
+void Vpk::ContentCache::insert(Entry &entry) {
+	if (entry.data.size() > m_capacity || m_lookup.find(entry.file) != m_lookup.end()) {
+		// too big or another thread was faster
+		return;
+	}
+
+	while (m_size + entry.data.size() > m_capacity) {
+		Entry &last = m_entries.back();
+		m_size -= last.data.size();
+		m_lookup.erase(last.file);
+		m_entries.pop_back();
+	}
+
+	m_entries.push_front(Entry());
+	Entry &added = m_entries.front();
+	added.file = entry.file;
+	added.data.swap(entry.data);
+	m_lookup[added.file] = m_entries.begin();
+	m_size += added.data.size();
+}
+
+void Vpk::ContentCache::clear() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_lookup.clear();
+	m_size = 0;
+}
+
+size_t Vpk::ContentCache::size() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_size;
+}
+
+uint64_t Vpk::ContentCache::hits() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_hits;
+}
+
+uint64_t Vpk::ContentCache::misses() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_misses;
+}
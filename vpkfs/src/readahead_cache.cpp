@@ -0,0 +1,181 @@
+/**
+ * unvpk - list, check and extract vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <vpk/readahead_cache.h>
+
+Vpk::ReadaheadCache::ReadaheadCache(size_t capacity, size_t windowSize)
+		: m_capacity(capacity), m_windowSize(windowSize ? windowSize : (size_t) DEFAULT_WINDOW_SIZE),
+		  m_size(0), m_hits(0), m_misses(0) {}
+
+ssize_t Vpk::ReadaheadCache::read(uint16_t index, int fd, char *buf, size_t size, off_t offset) {
+	size_t done;
+	bool sequential;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		done = cached(index, buf, size, offset);
+		if (done == size) {
+			++ m_hits;
+		}
+
+		sequential = this->sequential(index, offset + done);
+		m_next[index] = offset + size;
+	}
+
+	if (done < size && !sequential) {
+		ssize_t count;
+		do {
+			count = pread(fd, buf + done, size - done, offset + done);
+		} while (count < 0 && errno == EINTR);
+		if (count < 0) return done > 0 ? (ssize_t) done : -errno;
+		return done + count;
+	}
+
+	while (done < size) {
+		off_t pos = offset + done;
+		Window window;
+		window.key = Key(index, pos / m_windowSize);
+		window.data.resize(m_windowSize);
+
+		off_t  start = window.key.second * m_windowSize;
+		size_t count = 0;
+		while (count < m_windowSize) {
+			ssize_t chunk = pread(fd, &window.data[count], m_windowSize - count, start + count);
+			if (chunk < 0) {
+				if (errno == EINTR) continue;
+				return done > 0 ? (ssize_t) done : -errno;
+			}
+			if (chunk == 0) break;
+			count += chunk;
+		}
+		window.data.resize(count);
+
+		size_t skip = pos - start;
+		if (skip >= count) break; // end of archive
+
+		size_t length = std::min(size - done, count - skip);
+		memcpy(buf + done, &window.data[skip], length);
+		done += length;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++ m_misses;
+		insert(window);
+
+		if (count < m_windowSize) break;
+	}
+
+	return done;
+}
+
+bool Vpk::ReadaheadCache::wants(uint16_t index, size_t size, off_t offset) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Lookup::const_iterator found = m_lookup.find(Key(index, offset / m_windowSize));
+	if (found != m_lookup.end() &&
+			(size_t) (offset - found->second->key.second * m_windowSize) < found->second->data.size()) {
+		return true;
+	}
+
+	if (sequential(index, offset)) {
+		return true;
+	}
+
+	m_next[index] = offset + size;
+	return false;
+}
+
+// m_mutex has to be held
+bool Vpk::ReadaheadCache::sequential(uint16_t index, off_t pos) const {
+	// neighbouring files are allowed to be read a bit out of order
+	Positions::const_iterator next = m_next.find(index);
+	return next != m_next.end() &&
+		pos + (off_t) m_windowSize >= next->second &&
+		pos <= next->second + (off_t) m_windowSize;
+}
+
+// copies what is cached from the start of the range, m_mutex has to be held
+size_t Vpk::ReadaheadCache::cached(uint16_t index, char *buf, size_t size, off_t offset) {
+	size_t done = 0;
+	while (done < size) {
+		off_t pos = offset + done;
+		Lookup::iterator found = m_lookup.find(Key(index, pos / m_windowSize));
+		if (found == m_lookup.end()) break;
+
+		Windows::iterator window = found->second;
+		m_windows.splice(m_windows.begin(), m_windows, window);
+
+		size_t skip = pos - window->key.second * m_windowSize;
+		if (skip >= window->data.size()) break;
+
+		size_t length = std::min(size - done, window->data.size() - skip);
+		memcpy(buf + done, &window->data[skip], length);
+		done += length;
+
+		if (window->data.size() < m_windowSize) break;
+	}
+	return done;
+}
+
+// m_mutex has to be held
+void Vpk::ReadaheadCache::insert(Window &window) {
+	if (window.data.size() > m_capacity || m_lookup.find(window.key) != m_lookup.end()) {
+		// too big or another thread was faster
+		return;
+	}
+
+	while (m_size + window.data.size() > m_capacity) {
+		Window &last = m_windows.back();
+		m_size -= last.data.size();
+		m_lookup.erase(last.key);
+		m_windows.pop_back();
+	}
+
+	m_windows.push_front(Window());
+	Window &added = m_windows.front();
+	added.key = window.key;
+	added.data.swap(window.data);
+	m_lookup[added.key] = m_windows.begin();
+	m_size += added.data.size();
+}
+
+void Vpk::ReadaheadCache::clear() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_windows.clear();
+	m_lookup.clear();
+	m_next.clear();
+	m_size = 0;
+}
+
+size_t Vpk::ReadaheadCache::size() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_size;
+}
+
+uint64_t Vpk::ReadaheadCache::hits() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_hits;
+}
+
+uint64_t Vpk::ReadaheadCache::misses() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_misses;
+}
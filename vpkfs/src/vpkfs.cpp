@@ -24,9 +24,11 @@
 #include <sys/xattr.h>
 #include <endian.h>
 #include <stdint.h>
+#include <signal.h>
 
 #include <iostream>
 #include <limits>
+#include <algorithm>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem/operations.hpp>
@@ -36,6 +38,8 @@
 #include <vpk/vpkfs.h>
 #include <vpk/fuse_args.h>
 #include <vpk/io_error.h>
+#include <vpk/index_cache.h>
+#include <vpk/tree_iterator.h>
 
 namespace fs = boost::filesystem;
 
@@ -46,25 +50,65 @@ enum {
 	VPK_OPTS_ERROR   = 4
 };
 
+// the archive index of files whose data is in the _dir.vpk file, their
+// offsets are relative to its start
+enum { DIR_INDEX = 0x7fff };
+
 struct vpkfuse_config {
 	vpkfuse_config(
 		std::string &archive,
 		std::string &mountpoint,
-		int &flags)
+		int &flags,
+		bool &indexCache,
+		bool &lazy,
+		bool &readahead,
+		size_t &readaheadCache,
+		size_t &contentCache,
+		bool &threadFds,
+		bool &immutable,
+		bool &lowlevel,
+		bool &mapped)
 	: archive(archive),
 	  mountpoint(mountpoint),
 	  argind(0),
-	  flags(flags) {}
+	  flags(flags),
+	  indexCache(indexCache),
+	  lazy(lazy),
+	  readahead(readahead),
+	  readaheadCache(readaheadCache),
+	  contentCache(contentCache),
+	  threadFds(threadFds),
+	  immutable(immutable),
+	  lowlevel(lowlevel),
+	  mapped(mapped) {}
 
 	std::string &archive;
 	std::string &mountpoint;
 	int argind;
 	int &flags;
+	bool &indexCache;
+	bool &lazy;
+	bool &readahead;
+	size_t &readaheadCache;
+	size_t &contentCache;
+	bool &threadFds;
+	bool &immutable;
+	bool &lowlevel;
+	bool &mapped;
 };
 
 enum {
 	KEY_HELP,
-	KEY_VERSION
+	KEY_VERSION,
+	KEY_INDEX_CACHE,
+	KEY_LAZY,
+	KEY_READAHEAD,
+	KEY_READAHEAD_CACHE,
+	KEY_CONTENT_CACHE,
+	KEY_THREAD_FDS,
+	KEY_IMMUTABLE,
+	KEY_LOWLEVEL,
+	KEY_MMAP
 };
 
 static struct fuse_opt vpkfuse_opts[] = {
@@ -72,6 +116,15 @@ static struct fuse_opt vpkfuse_opts[] = {
 	FUSE_OPT_KEY("--version", KEY_VERSION),
 	FUSE_OPT_KEY("-h",        KEY_HELP),
 	FUSE_OPT_KEY("--help",    KEY_HELP),
+	FUSE_OPT_KEY("index_cache", KEY_INDEX_CACHE),
+	FUSE_OPT_KEY("lazy",        KEY_LAZY),
+	FUSE_OPT_KEY("readahead",   KEY_READAHEAD),
+	FUSE_OPT_KEY("readahead_cache=", KEY_READAHEAD_CACHE),
+	FUSE_OPT_KEY("cache_size=", KEY_CONTENT_CACHE),
+	FUSE_OPT_KEY("thread_fds",  KEY_THREAD_FDS),
+	FUSE_OPT_KEY("immutable",   KEY_IMMUTABLE),
+	FUSE_OPT_KEY("lowlevel",    KEY_LOWLEVEL),
+	FUSE_OPT_KEY("mmap",        KEY_MMAP),
 	FUSE_OPT_END
 };
 
@@ -88,13 +141,54 @@ void usage(const char *binary) {
 		"    -d   -o debug          enable debug output (implies -f)\n"
 		"    -f                     foreground operation\n"
 		"    -s                     disable multi-threaded operation\n"
-		"                           Note that this might actually increase\n"
-		"                           performance in case you access the\n"
-		"                           filesystem with only one process.\n"
+		"    -o index_cache         cache the parsed archive index in\n"
+		"                           $XDG_CACHE_HOME/vpk (default: ~/.cache/vpk)\n"
+		"    -o lazy                only scan the archive index when mounting and\n"
+		"                           read the files of a directory when it is\n"
+		"                           accessed for the first time\n"
+		"    -o readahead           ask the kernel to read the first MiB of a\n"
+		"                           file when it is opened (only a hint)\n"
+		"    -o readahead_cache=MB  memory for caching archive data around\n"
+		"                           sequential reads, e.g. 32 (default: 0,\n"
+		"                           disabled), other reads are spliced\n"
+		"    -o cache_size=MB       memory for caching whole files of up to\n"
+		"                           64 KiB (default: 0, disabled)\n"
+		"    -o thread_fds          every thread opens the archives itself\n"
+		"    -o immutable           let the kernel cache entries and attributes\n"
+		"                           until the archive is unmounted\n"
+		"    -o lowlevel            use the FUSE low-level API (implies\n"
+		"                           -o immutable and that the whole index is\n"
+		"                           read when mounting)\n"
+		"    -o mmap                map the archives and copy file data from the\n"
+		"                           mappings instead of reading it\n"
 		"\n"
 		"(c) 2011 Mathias Panzenböck\n";
 }
 
+// set by SIGUSR1, the next stat() takes the attributes of the archives again
+static std::atomic<bool> vpk_stats_outdated(false);
+
+static void vpk_stats_outdated_handler(int) {
+	vpk_stats_outdated.store(true);
+}
+
+// the archive fds of one FUSE worker thread, see Vpkfs::setThreadFds()
+struct ThreadFds {
+	ThreadFds(size_t count) : fds(count, -1) {}
+
+	// -1: not opened yet, -2: opening failed
+	std::vector<int> fds;
+};
+
+static void vpk_close_thread_fds(void *data) {
+	ThreadFds *fds = (ThreadFds*) data;
+	if (!fds) return;
+	for (std::vector<int>::const_iterator i = fds->fds.begin(); i != fds->fds.end(); ++ i) {
+		if (*i >= 0) ::close(*i);
+	}
+	delete fds;
+}
+
 static int vpkfuse_opt_proc(struct vpkfuse_config *conf, const char *arg, int key, struct fuse_args *outargs) {
 	switch (key) {
 	case FUSE_OPT_KEY_NONOPT:
@@ -126,6 +220,54 @@ static int vpkfuse_opt_proc(struct vpkfuse_config *conf, const char *arg, int ke
 		std::cout << "vpkfs version " << Vpk::VERSION << std::endl;
 		conf->flags |= VPK_OPTS_VERSION;
 		break;
+
+	case KEY_INDEX_CACHE:
+		conf->indexCache = true;
+		return 0;
+
+	case KEY_LAZY:
+		conf->lazy = true;
+		return 0;
+
+	case KEY_READAHEAD:
+		conf->readahead = true;
+		return 0;
+
+	case KEY_THREAD_FDS:
+		conf->threadFds = true;
+		return 0;
+
+	case KEY_IMMUTABLE:
+		conf->immutable = true;
+		return 0;
+
+	case KEY_LOWLEVEL:
+		conf->lowlevel = true;
+		return 0;
+
+	case KEY_MMAP:
+		conf->mapped = true;
+		return 0;
+
+	case KEY_READAHEAD_CACHE:
+		try {
+			conf->readaheadCache = boost::lexical_cast<size_t>(strchr(arg, '=') + 1) * 1024 * 1024;
+		}
+		catch (const boost::bad_lexical_cast&) {
+			std::cerr << "*** error: illegal readahead_cache size: " << arg << std::endl;
+			conf->flags |= VPK_OPTS_ERROR;
+		}
+		return 0;
+
+	case KEY_CONTENT_CACHE:
+		try {
+			conf->contentCache = boost::lexical_cast<size_t>(strchr(arg, '=') + 1) * 1024 * 1024;
+		}
+		catch (const boost::bad_lexical_cast&) {
+			std::cerr << "*** error: illegal cache_size: " << arg << std::endl;
+			conf->flags |= VPK_OPTS_ERROR;
+		}
+		return 0;
 	}
 	return 1;
 }
@@ -133,10 +275,22 @@ static int vpkfuse_opt_proc(struct vpkfuse_config *conf, const char *arg, int ke
 Vpk::Vpkfs::Vpkfs(int argc, char *argv[], bool allocated)
 		: m_args(argc, argv, allocated),
 		  m_flags(VPK_OPTS_OK),
+		  m_indexCache(false),
+		  m_lazy(false),
+		  m_readahead(false),
+		  m_threadFds(false),
+		  m_immutable(false),
+		  m_lowlevel(false),
+		  m_mapped(false),
+		  m_readaheadCacheSize(0),
+		  m_contentCacheSize(0),
 		  m_handler(true),
 		  m_package(&this->m_handler),
-		  m_files(0) {
-	struct vpkfuse_config conf(m_archive, m_mountpoint, m_flags);
+		  m_dirFd(-1),
+		  m_files(0),
+		  m_threadFdsKeyCreated(false) {
+	struct vpkfuse_config conf(m_archive, m_mountpoint, m_flags, m_indexCache, m_lazy, m_readahead,
+		m_readaheadCacheSize, m_contentCacheSize, m_threadFds, m_immutable, m_lowlevel, m_mapped);
 	m_args.parse(&conf, vpkfuse_opts, vpkfuse_opt_proc);
 	
 	if (m_flags == VPK_OPTS_OK) {
@@ -162,11 +316,22 @@ Vpk::Vpkfs::Vpkfs(
 	bool               singlethreaded,
 	const std::string &mountopts)
 		: m_flags(VPK_OPTS_OK),
+		  m_indexCache(false),
+		  m_lazy(false),
+		  m_readahead(false),
+		  m_threadFds(false),
+		  m_immutable(false),
+		  m_lowlevel(false),
+		  m_mapped(false),
+		  m_readaheadCacheSize(0),
+		  m_contentCacheSize(0),
 		  m_archive(archive),
 		  m_mountpoint(mountpoint),
 		  m_handler(true),
 		  m_package(&this->m_handler),
-		  m_files(0) {
+		  m_dirFd(-1),
+		  m_files(0),
+		  m_threadFdsKeyCreated(false) {
 	m_args.add_arg("vpkfs");
 	if (singlethreaded) {
 		m_args.add_arg("-s");
@@ -265,20 +430,46 @@ void Vpk::Vpkfs::setup() {
 	m_operations.flag_nopath      = 1;
 	m_operations.read_buf         = vpk_read_buf;
 #endif
+
+	setupLowlevel();
 }
 
-void Vpk::Vpkfs::statfs(const Node *node) {
+void Vpk::Vpkfs::statfs(const Dir &root) {
+	// the root counts as well
 	++ m_files;
-	if (node->type() == Node::DIR) {
-		const Nodes &nodes = ((const Dir*) node)->nodes();
-		for (Nodes::const_iterator i = nodes.begin(); i != nodes.end(); ++ i) {
-			statfs(i->second.get());
+	for (TreeIterator it(root); it.next();) {
+		switch (it.step()) {
+		case TreeIterator::FILE:
+			// a file of only preload data is read from the index
+			if (it.file().size > 0) m_indices.insert(it.file().index);
+			++ m_files;
+			break;
+
+		case TreeIterator::ENTER:
+			++ m_files;
+			break;
+
+		case TreeIterator::LEAVE:
+			break;
 		}
 	}
-	else {
-		uint16_t arch = ((const File*) node)->index;
-		if (m_indices.find(arch) == m_indices.end()) {
-			m_indices.insert(arch);
+}
+
+// Numbers the children of the dir ino, then the children of its subdirs.
+void Vpk::Vpkfs::number(fuse_ino_t ino) {
+	const Nodes &nodes = ((const Dir*) m_inodes[ino].node)->nodes();
+	fuse_ino_t first = m_inodes.size();
+	m_inodes[ino].children = first;
+
+	for (Nodes::const_iterator i = nodes.begin(); i != nodes.end(); ++ i) {
+		Node *child = i->second.get();
+		child->setInode(m_inodes.size());
+		m_inodes.push_back(Inode(child, ino));
+	}
+
+	for (fuse_ino_t child = first; child < first + nodes.size(); ++ child) {
+		if (m_inodes[child].node->type() == Node::DIR) {
+			number(child);
 		}
 	}
 }
@@ -286,6 +477,14 @@ void Vpk::Vpkfs::statfs(const Node *node) {
 int Vpk::Vpkfs::run() {
 	if (m_flags & VPK_OPTS_ERROR) return 1;
 	if (m_flags & (VPK_OPTS_HELP | VPK_OPTS_VERSION)) return 0;
+	if (m_lowlevel) return runLowlevel();
+
+	if (m_immutable) {
+		// in front of the other options, so they can still be overridden
+		std::string timeout = boost::lexical_cast<std::string>((int) CACHE_TIMEOUT);
+		m_args.insert_arg(1, "-oentry_timeout=" + timeout +
+			",negative_timeout=" + timeout + ",attr_timeout=" + timeout);
+	}
 
 	return fuse_main(m_args.argc(), m_args.argv(), &m_operations, this);
 }
@@ -293,14 +492,54 @@ int Vpk::Vpkfs::run() {
 void Vpk::Vpkfs::init() {
 	clear();
 	m_handler.setRaise(true);
-	m_package.read(m_archive);
+	// A cache hit is always built lazily from the mapped records, with
+	// -o lazy a cache miss keeps the parsed CompactTree too. The low-level
+	// API needs all nodes numbered, which decodes everything.
+	m_package.setLazy(m_lazy && !m_lowlevel);
+	if (m_indexCache) {
+		m_package.read(m_archive, IndexCache());
+	}
+	else {
+		m_package.read(m_archive);
+	}
 	m_handler.setRaise(false);
 
-	m_files = 0;
-	statfs(&m_package);
+	const LazyIndex *lazyIndex = m_package.lazyIndex();
+	if (lazyIndex) {
+		// walking the tree would decode everything
+		m_files = lazyIndex->dirs + lazyIndex->files + 1;
+		m_indices.insert(lazyIndex->archives.begin(), lazyIndex->archives.end());
+	}
+	else {
+		// the low-level API looks up nodes by inode number, not by path
+		if (!m_lowlevel) {
+			m_package.buildIndex();
+		}
+		m_files = 0;
+		statfs(m_package);
+	}
+
+	if (m_lowlevel) {
+		m_inodes.reserve(m_files + 1);
+		m_inodes.push_back(Inode(0, 0));
+		m_inodes.push_back(Inode(&m_package, FUSE_ROOT_ID));
+		m_package.setInode(FUSE_ROOT_ID);
+		number(FUSE_ROOT_ID);
+	}
+
+	// The _dir.vpk file is m_dirFd, so the table only spans the
+	// *_NNN.vpk files, of which there are a few dozen at most.
+	size_t count = 0;
+	for (Indices::const_iterator i = m_indices.begin(); i != m_indices.end(); ++ i) {
+		if (*i != DIR_INDEX) count = std::max(count, (size_t) *i + 1);
+	}
+	m_archives.resize(count, -1);
+	m_archivePaths.resize(count);
 
 	for (Indices::const_iterator i = m_indices.begin(); i != m_indices.end(); ++ i) {
 		uint16_t index = *i;
+		if (index == DIR_INDEX) continue;
+
 		fs::path archivePath(m_package.archivePath(index));
 		int fd = ::open(archivePath.string().c_str(), O_RDONLY);
 		if (fd < 0) {
@@ -310,13 +549,126 @@ void Vpk::Vpkfs::init() {
 				<< strerror(errnum) << std::endl;
 			throw IOError(errnum);
 		}
-		m_archives[index] = fd;
+		m_archives[index]     = fd;
+		m_archivePaths[index] = archivePath.string();
+	}
+
+	statArchives();
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = vpk_stats_outdated_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR1, &action, 0) != 0) {
+		throw IOError(errno);
+	}
+
+	// for splicing preload data, see read_buf()
+	m_dirFd = ::open(m_archive.c_str(), O_RDONLY);
+	if (m_dirFd < 0) {
+		int errnum = errno;
+		std::cerr
+			<< "*** error opening archive \"" << m_archive << "\": "
+			<< strerror(errnum) << std::endl;
+		throw IOError(errnum);
 	}
+
+	if (m_threadFds) {
+		int errnum = pthread_key_create(&m_threadFdsKey, vpk_close_thread_fds);
+		if (errnum != 0) {
+			throw IOError(errnum);
+		}
+		m_threadFdsKeyCreated = true;
+	}
+
+	// created here and not in the constructor because fuse_main() forks
+	if (m_mapped) {
+		// reads jump around, the kernel shouldn't read far ahead
+		m_mappedArchives.reset(new ArchiveSet(m_package, MADV_NORMAL));
+		for (size_t index = 0; index < m_archives.size(); ++ index) {
+			if (m_archives[index] >= 0) m_mappedArchives->map(index);
+		}
+		if (m_indices.count(DIR_INDEX) > 0) {
+			m_mappedArchives->map(DIR_INDEX);
+		}
+	}
+
+	// the mappings already keep the data around
+	if (m_readaheadCacheSize > 0 && !m_mapped) {
+		m_readaheadCache.reset(new ReadaheadCache(m_readaheadCacheSize));
+	}
+
+	if (m_contentCacheSize > 0) {
+		m_contentCache.reset(new ContentCache(m_contentCacheSize));
+	}
+}
+
+// the attributes a node takes from its archive
+static void vpk_stat_archive(const struct stat *archst, struct stat *stbuf) {
+	stbuf->st_uid = archst->st_uid;
+	stbuf->st_gid = archst->st_gid;
+	stbuf->st_blksize = archst->st_blksize;
+	stbuf->st_atime = archst->st_atime;
+	stbuf->st_ctime = archst->st_ctime;
+	stbuf->st_mtime = archst->st_mtime;
+}
+
+// Takes new StatTemplates, so stat() doesn't have to ask the archives on
+// every call. Done in init() and again after a SIGUSR1.
+void Vpk::Vpkfs::statArchives() {
+	std::shared_ptr<StatTemplates> stats(new StatTemplates());
+	struct stat archst;
+	if (::stat(m_archive.c_str(), &archst) != 0) {
+		throw IOError(errno);
+	}
+	memset(&stats->dir, 0, sizeof(struct stat));
+	vpk_stat_archive(&archst, &stats->dir);
+
+	// only the *_NNN.vpk files in use, see init()
+	stats->archives.resize(m_archives.size());
+	for (size_t index = 0; index < m_archives.size(); ++ index) {
+		memset(&stats->archives[index], 0, sizeof(struct stat));
+		if (m_archives[index] < 0) continue;
+
+		if (fstat(m_archives[index], &archst) != 0) {
+			throw IOError(errno);
+		}
+		vpk_stat_archive(&archst, &stats->archives[index]);
+	}
+
+	// the old templates are freed when the last reader drops them
+	std::atomic_store(&m_stats, std::shared_ptr<const StatTemplates>(stats));
+}
+
+int Vpk::Vpkfs::archiveFd(uint16_t index) const {
+	if (index == DIR_INDEX) return m_dirFd;
+	if (index >= m_archives.size()) return -1;
+
+	int fd = m_archives[index];
+	if (!m_threadFdsKeyCreated || fd < 0) return fd;
+
+	ThreadFds *fds = (ThreadFds*) pthread_getspecific(m_threadFdsKey);
+	if (!fds) {
+		fds = new ThreadFds(m_archives.size());
+		if (pthread_setspecific(m_threadFdsKey, fds) != 0) {
+			delete fds;
+			return fd;
+		}
+	}
+
+	int &own = fds->fds[index];
+	if (own == -1) {
+		own = ::open(m_archivePaths[index].c_str(), O_RDONLY);
+		// don't try again, the shared fd works just as well
+		if (own < 0) own = -2;
+	}
+	return own >= 0 ? own : fd;
 }
 
 // only minimal stat:
 static struct stat *vpk_stat(const Vpk::Node *node, struct stat *stbuf) {
-	stbuf->st_ino = (ino_t) node;
+	stbuf->st_ino = node->inode() ? (ino_t) node->inode() : (ino_t) node;
 	if (node->type() == Vpk::Node::DIR) {
 		stbuf->st_mode  = S_IFDIR | 0555;
 		stbuf->st_nlink = ((Vpk::Dir *) node)->subdirs() + 2;
@@ -332,36 +684,37 @@ static struct stat *vpk_stat(const Vpk::Node *node, struct stat *stbuf) {
 
 int Vpk::Vpkfs::getattr(const char *path, struct stat *stbuf) {
 	Node *node = m_package.get(path);
-	memset(stbuf, 0, sizeof(struct stat));
 
 	if (!node) {
+		memset(stbuf, 0, sizeof(struct stat));
 		return -ENOENT;
 	}
 
-	vpk_stat(node, stbuf);
+	return stat(node, stbuf);
+}
 
-	struct stat archst;
-	int code = 0;
-	if (node->type() == Vpk::Node::FILE && ((File*) node)->size) {
-		int fd = m_archives[((File*) node)->index];
-		code = fstat(fd, &archst);
-	}
-	else {
-		code = stat(m_archive.c_str(), &archst);
+int Vpk::Vpkfs::stat(const Node *node, struct stat *stbuf) {
+	if (vpk_stats_outdated.load(std::memory_order_relaxed) && vpk_stats_outdated.exchange(false)) {
+		try {
+			statArchives();
+		}
+		catch (const std::exception &exc) {
+			// keep serving the old attributes
+			std::cerr << "*** error refreshing attributes: " << exc.what() << std::endl;
+		}
 	}
 
-	if (code == 0) {
-		stbuf->st_uid = archst.st_uid;
-		stbuf->st_gid = archst.st_gid;
-		stbuf->st_blksize = archst.st_blksize;
-		stbuf->st_atime = archst.st_atime;
-		stbuf->st_ctime = archst.st_ctime;
-		stbuf->st_mtime = archst.st_mtime;
-		return 0;
+	std::shared_ptr<const StatTemplates> stats = std::atomic_load(&m_stats);
+	const File *file = node->type() == Vpk::Node::FILE ? (const File*) node : 0;
+	if (file && file->size && file->index != DIR_INDEX) {
+		*stbuf = stats->archives[file->index];
 	}
 	else {
-		return -errno;
+		*stbuf = stats->dir;
 	}
+	vpk_stat(node, stbuf);
+
+	return 0;
 }
 
 int Vpk::Vpkfs::opendir(const char *path, struct fuse_file_info *fi) {
@@ -394,18 +747,22 @@ int Vpk::Vpkfs::readdir(const char *, void *buf, fuse_fill_dir_t filler,
 	if (filler(buf, ".", vpk_stat(dir, &stbuf), 0)) return 0;
 	if (filler(buf, "..", NULL, 0)) return 0;
 
+	// the attributes are at hand, so pass all of them and not just the type
 	const Nodes &nodes = dir->nodes();
 	for (Nodes::const_iterator i = nodes.begin(); i != nodes.end(); ++ i) {
 		const Node *child = i->second.get();
-		if (filler(buf, child->name().c_str(), vpk_stat(child, &stbuf), 0)) return 0;
+		stat(child, &stbuf);
+		if (filler(buf, child->name().c_str(), &stbuf, 0)) return 0;
 	}
 
 	return 0;
 }
 
 int Vpk::Vpkfs::open(const char *path, struct fuse_file_info *fi) {
-	Node *node = m_package.get(path);
-	
+	return open(m_package.get(path), fi);
+}
+
+int Vpk::Vpkfs::open(Node *node, struct fuse_file_info *fi) {
 	if (!node)
 		return -ENOENT;
 
@@ -418,6 +775,18 @@ int Vpk::Vpkfs::open(const char *path, struct fuse_file_info *fi) {
 	fi->keep_cache = 1;
 	fi->fh = (intptr_t) (File *) node;
 
+	File *file = (File *) node;
+	if (m_readahead && file->size > 0) {
+		size_t size = std::min((size_t) file->size, (size_t) READAHEAD_SIZE);
+		if (m_mappedArchives) {
+			m_mappedArchives->willneed(file->index, file->offset, size);
+		}
+		else {
+			// only a hint, the data is read by the page cache
+			posix_fadvise(archiveFd(file->index), file->offset, size, POSIX_FADV_WILLNEED);
+		}
+	}
+
 	return 0;
 }
 
@@ -440,12 +809,18 @@ int Vpk::Vpkfs::read(const char *, char *buf, size_t size, off_t offset,
 
 	size_t rest = std::min(size - count, fileSize - offset - count);
 	if (rest) {
-		int fd = m_archives[file->index];
-		ssize_t restcount = pread(fd, buf + count, rest,
-			file->offset + (offset + count - preloadSize));
+		ssize_t restcount;
+		if (m_contentCache && m_contentCache->cacheable(file)) {
+			restcount = m_contentCache->read(file, archiveFd(file->index), buf + count, rest,
+				offset + count - preloadSize);
+		}
+		else {
+			restcount = readArchive(file->index, buf + count, rest,
+				file->offset + (offset + count - preloadSize));
+		}
 
 		if (restcount < 0) {
-			return -errno;
+			return restcount;
 		}
 		count += restcount;
 	}
@@ -453,8 +828,28 @@ int Vpk::Vpkfs::read(const char *, char *buf, size_t size, off_t offset,
 	return count;
 }
 
+ssize_t Vpk::Vpkfs::readArchive(uint16_t index, char *buf, size_t size, off_t offset) {
+	if (m_mappedArchives) {
+		const MMap *map = m_mappedArchives->archive(index);
+		if (!map) return -EIO;
+		if ((size_t) offset >= map->size()) return 0;
+
+		size_t count = std::min(size, map->size() - offset);
+		memcpy(buf, map->data() + offset, count);
+		return count;
+	}
+
+	int fd = archiveFd(index);
+	if (m_readaheadCache) {
+		return m_readaheadCache->read(index, fd, buf, size, offset);
+	}
+
+	ssize_t count = pread(fd, buf, size, offset);
+	return count < 0 ? -errno : count;
+}
+
 #if FUSE_USE_VERSION >= 29
-int Vpk::Vpkfs::read_buf(const char *, struct fuse_bufvec **bufp,
+int Vpk::Vpkfs::read_buf(const char *path, struct fuse_bufvec **bufp,
              size_t size, off_t offset, struct fuse_file_info *fi) {
 	if (offset < 0) return -EINVAL;
 
@@ -465,60 +860,78 @@ int Vpk::Vpkfs::read_buf(const char *, struct fuse_bufvec **bufp,
 	size_t fileSize = preloadSize + file->size;
 
 	size_t count = 0;
-	if ((size_t)offset >= fileSize) {
+	size_t rest  = 0;
+	if ((size_t)offset < fileSize) {
+		if ((size_t)offset < preloadSize) {
+			count = std::min(size, preloadSize - offset);
+		}
+		rest = std::min(size - count, fileSize - offset - count);
+	}
+
+	if (rest > 0 && (m_mappedArchives ||
+			(m_contentCache && m_contentCache->cacheable(file)) ||
+			(m_readaheadCache && m_readaheadCache->wants(file->index, rest,
+				file->offset + (offset + count - preloadSize))))) {
+		// mapped or cached data is in memory anyway, so there is nothing to splice
 		bufvec = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec));
 		if (!bufvec) return -ENOMEM;
-		bufvec->buf[0].fd = -1;
+		void *buf = malloc(size ? size : 1);
+		if (!buf) {
+			free(bufvec);
+			return -ENOMEM;
+		}
+		int length = read(path, (char *) buf, size, offset, fi);
+		if (length < 0) {
+			free(buf);
+			free(bufvec);
+			return length;
+		}
+		bufvec->count       = 1;
+		bufvec->buf[0].size = length;
+		bufvec->buf[0].mem  = buf;
+		bufvec->buf[0].fd   = -1;
+		*bufp = bufvec;
+		return length;
 	}
-	else if ((size_t)offset < preloadSize) {
-		count = std::min(size, preloadSize - offset);
-		void *buf = malloc(count);
-		if (!buf) return -ENOMEM;
-		memcpy(buf, &file->preload[offset], count);
 
-		size_t rest = std::min(size - count, fileSize - offset - count);
-		if (rest) {
-			bufvec = (struct fuse_bufvec*)calloc(1,
-				sizeof(struct fuse_bufvec) + sizeof(struct fuse_buf));
-			if (!bufvec) {
-				free(buf);
-				return -ENOMEM;
-			}
-			bufvec->count        = 2;
-			bufvec->buf[0].size  = count;
-			bufvec->buf[0].mem   = buf;
-			bufvec->buf[0].fd    = -1;
-			bufvec->buf[1].size  = rest;
-			bufvec->buf[1].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
-			bufvec->buf[1].fd    = m_archives[file->index];
-			bufvec->buf[1].pos   = file->offset + (offset + count - preloadSize);
-
-			count += rest;
+	// room for the preload data and the archive data
+	bufvec = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec) + sizeof(struct fuse_buf));
+	if (!bufvec) return -ENOMEM;
+	bufvec->buf[0].fd = -1;
+
+	struct fuse_buf *buf = bufvec->buf;
+	if (count > 0) {
+		if (file->preloadOffset > 0 && m_dirFd >= 0) {
+			// the preload data is in the _dir.vpk file too, so it can be
+			// spliced from there just like archive data
+			buf->flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+			buf->fd    = m_dirFd;
+			buf->pos   = file->preloadOffset + offset;
 		}
 		else {
-			bufvec = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec));
-			if (!bufvec) {
-				free(buf);
+			buf->mem = malloc(count);
+			if (!buf->mem) {
+				free(bufvec);
 				return -ENOMEM;
 			}
-			bufvec->count       = 1;
-			bufvec->buf[0].size = count;
-			bufvec->buf[0].mem  = buf;
-			bufvec->buf[0].fd   = -1;
+			memcpy(buf->mem, &file->preload[offset], count);
+			buf->fd = -1;
 		}
+		buf->size = count;
+		++ bufvec->count;
+		++ buf;
 	}
-	else {
-		bufvec = (struct fuse_bufvec*)calloc(1, sizeof(struct fuse_bufvec));
-		if (!bufvec) return -ENOMEM;
-		bufvec->count        = 1;
-		bufvec->buf[0].size  = count = std::min(size, fileSize - offset);
-		bufvec->buf[0].flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
-		bufvec->buf[0].fd    = m_archives[file->index];
-		bufvec->buf[0].pos   = file->offset + (offset - preloadSize);
+
+	if (rest > 0) {
+		buf->size  = rest;
+		buf->flags = (enum fuse_buf_flags)(FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+		buf->fd    = archiveFd(file->index);
+		buf->pos   = file->offset + (offset + count - preloadSize);
+		++ bufvec->count;
 	}
 
 	*bufp = bufvec;
-	return count;
+	return count + rest;
 }
 #endif
 
@@ -527,7 +940,7 @@ int Vpk::Vpkfs::statfs(const char *, struct statvfs *stbuf) {
 	fsfilcnt_t fssize = 0;
 	memset(stbuf, 0, sizeof(struct statvfs));
 
-	int code = stat(m_archive.c_str(), &archst);
+	int code = ::stat(m_archive.c_str(), &archst);
 	if (code != 0) {
 		return code;
 	}
@@ -539,7 +952,10 @@ int Vpk::Vpkfs::statfs(const char *, struct statvfs *stbuf) {
 	
 	for (boost::unordered_set<uint16_t>::const_iterator i = m_indices.begin();
 			i != m_indices.end(); ++ i) {
-		code = stat(m_package.archivePath(*i).string().c_str(), &archst);
+		// counted already
+		if (*i == DIR_INDEX) continue;
+
+		code = ::stat(m_package.archivePath(*i).string().c_str(), &archst);
 
 		if (code != 0) {
 			return code;
@@ -566,22 +982,33 @@ int Vpk::Vpkfs::statfs(const char *, struct statvfs *stbuf) {
 	"\0user.vpkfs.archive_path" \
 	"\0user.vpkfs.offset"
 
+#define VPK_XATTRS_CACHE_ONLY \
+	"\0user.vpkfs.cache_hits" \
+	"\0user.vpkfs.cache_misses"
+
 #define VPK_XATTRS_DIR      VPK_XATTRS_ALL
+#define VPK_XATTRS_ROOT     VPK_XATTRS_ALL VPK_XATTRS_CACHE_ONLY
 #define VPK_XATTRS_INLINED  VPK_XATTRS_ALL VPK_XATTRS_FILES_ONLY
 #define VPK_XATTRS_ARCHIVED VPK_XATTRS_INLINED VPK_XATTRS_ARCHIVED_ONLY
 
 int Vpk::Vpkfs::listxattr(const char *path, char *buf, size_t size) {
-	Node *node = m_package.get(path);
+	return listxattr(m_package.get(path), buf, size);
+}
 
+int Vpk::Vpkfs::listxattr(const Node *node, char *buf, size_t size) {
 	if (!node) return -ENOENT;
 
 	size_t xattrs_size = 0;
 	const char *xattrs_list = 0;
-	if (node->type() == Node::DIR) {
+	if (node == &m_package && m_contentCache) {
+		xattrs_size = sizeof(VPK_XATTRS_ROOT);
+		xattrs_list = VPK_XATTRS_ROOT;
+	}
+	else if (node->type() == Node::DIR) {
 		xattrs_size = sizeof(VPK_XATTRS_DIR);
 		xattrs_list = VPK_XATTRS_DIR;
 	}
-	else if (((File*) node)->size) {
+	else if (((const File*) node)->size) {
 		xattrs_size = sizeof(VPK_XATTRS_ARCHIVED);
 		xattrs_list = VPK_XATTRS_ARCHIVED;
 	}
@@ -601,6 +1028,7 @@ int Vpk::Vpkfs::listxattr(const char *path, char *buf, size_t size) {
 
 static uint16_t tobe(uint16_t value) { return htobe16(value); }
 static uint32_t tobe(uint32_t value) { return htobe32(value); }
+static uint64_t tobe(uint64_t value) { return htobe64(value); }
 
 template<typename Value>
 static int getxattr(Value value, char *buf, size_t size) {
@@ -625,18 +1053,26 @@ static int getxattr(const std::string &value, char *buf, size_t size) {
 }
 
 int Vpk::Vpkfs::getxattr(const char *path, const char *name, char *buf, size_t size) {
-	Node *node = m_package.get(path);
+	return getxattr(m_package.get(path), name, buf, size);
+}
 
+int Vpk::Vpkfs::getxattr(const Node *node, const char *name, char *buf, size_t size) {
 	if (!node) return -ENOENT;
 	
 	if (strcmp(name, "user.vpkfs.dir_path") == 0) {
 		return ::getxattr(m_archive, buf, size);
 	}
+	else if (node == &m_package && m_contentCache && strcmp(name, "user.vpkfs.cache_hits") == 0) {
+		return ::getxattr(m_contentCache->hits(), buf, size);
+	}
+	else if (node == &m_package && m_contentCache && strcmp(name, "user.vpkfs.cache_misses") == 0) {
+		return ::getxattr(m_contentCache->misses(), buf, size);
+	}
 	else if (node->type() != Node::FILE) {
 		return -ENODATA;
 	}
 	else {
-		File *file = (File*) node;
+		const File *file = (const File*) node;
 		if (strcmp(name, "user.vpkfs.crc32") == 0) {
 			return ::getxattr(file->crc32, buf, size);
 		}
@@ -662,17 +1098,39 @@ int Vpk::Vpkfs::getxattr(const char *path, const char *name, char *buf, size_t s
 }
 
 void Vpk::Vpkfs::clear() {
-	for (Archives::iterator i = m_archives.begin(); i != m_archives.end(); ++ i) {
-		int fd = i->second;
+	if (m_threadFdsKeyCreated) {
+		// The fds of the worker threads are closed when they exit. This
+		// only drops the fds of the calling thread.
+		vpk_close_thread_fds(pthread_getspecific(m_threadFdsKey));
+		pthread_setspecific(m_threadFdsKey, 0);
+		pthread_key_delete(m_threadFdsKey);
+		m_threadFdsKeyCreated = false;
+	}
+
+	for (size_t index = 0; index < m_archives.size(); ++ index) {
+		int fd = m_archives[index];
 		if (fd >= 0 && ::close(fd) != 0) {
 			int errnum = errno;
 			std::cerr
 				<< "*** error closing archive \""
-				<< m_package.archivePath(i->first) << "\": "
+				<< m_package.archivePath(index) << "\": "
 				<< strerror(errnum) << std::endl;
 		}
-		m_archives[i->first] = -1;
 	}
+	if (m_dirFd >= 0 && ::close(m_dirFd) != 0) {
+		int errnum = errno;
+		std::cerr
+			<< "*** error closing archive \"" << m_archive << "\": "
+			<< strerror(errnum) << std::endl;
+	}
+	m_dirFd = -1;
+
 	m_archives.clear();
+	m_archivePaths.clear();
+	std::atomic_store(&m_stats, std::shared_ptr<const StatTemplates>());
 	m_indices.clear();
+	m_inodes.clear();
+	m_mappedArchives.reset();
+	m_readaheadCache.reset();
+	m_contentCache.reset();
 }
@@ -0,0 +1,338 @@
+/**
+ * vpkfs - mount vpk archives
+ * Copyright (C) 2011  Mathias Panzenböck <grosser.meister.morti@gmx.net>
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <fuse_lowlevel.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <vpk/file.h>
+#include <vpk/vpkfs.h>
+
+static void vpk_ll_init(void *userdata, struct fuse_conn_info *) {
+	try {
+		((Vpk::Vpkfs*) userdata)->init();
+	}
+	catch (const std::exception &exc) {
+		std::cerr << "*** error: " << exc.what() << std::endl;
+		exit(1); // can't throw through C code
+	}
+	catch (...) {
+		std::cerr << "*** unknown exception\n";
+		exit(1); // can't throw through C code
+	}
+}
+
+static void vpk_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->lookup(req, parent, name);
+}
+
+static void vpk_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->getattr(req, ino, fi);
+}
+
+static void vpk_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->opendir(req, ino, fi);
+}
+
+static void vpk_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                           struct fuse_file_info *fi) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->readdir(req, ino, size, off, fi);
+}
+
+static void vpk_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->open(req, ino, fi);
+}
+
+static void vpk_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                        struct fuse_file_info *fi) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->read(req, ino, size, off, fi);
+}
+
+static void vpk_ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->statfs(req, ino);
+}
+
+static void vpk_ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->listxattr(req, ino, size);
+}
+
+static void vpk_ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size) {
+	((Vpk::Vpkfs*) fuse_req_userdata(req))->getxattr(req, ino, name, size);
+}
+
+// xattr requests with size 0 only ask how big the value is
+static void vpk_reply_xattr(fuse_req_t req, int count, const std::vector<char> &buf, size_t size) {
+	if (count < 0) {
+		fuse_reply_err(req, -count);
+	}
+	else if (size == 0) {
+		fuse_reply_xattr(req, count);
+	}
+	else {
+		fuse_reply_buf(req, &buf[0], count);
+	}
+}
+
+#if FUSE_USE_VERSION >= 29
+static void vpk_free_bufvec(struct fuse_bufvec *bufvec) {
+	for (size_t i = 0; i < bufvec->count; ++ i) {
+		if (!(bufvec->buf[i].flags & FUSE_BUF_IS_FD)) {
+			free(bufvec->buf[i].mem);
+		}
+	}
+	free(bufvec);
+}
+#endif
+
+void Vpk::Vpkfs::setupLowlevel() {
+	memset(&m_lowlevelOperations, 0, sizeof(m_lowlevelOperations));
+
+	// nodes live as long as the mount, so there is nothing to forget
+	m_lowlevelOperations.init      = vpk_ll_init;
+	m_lowlevelOperations.lookup    = vpk_ll_lookup;
+	m_lowlevelOperations.getattr   = vpk_ll_getattr;
+	m_lowlevelOperations.opendir   = vpk_ll_opendir;
+	m_lowlevelOperations.readdir   = vpk_ll_readdir;
+	m_lowlevelOperations.open      = vpk_ll_open;
+	m_lowlevelOperations.read      = vpk_ll_read;
+	m_lowlevelOperations.statfs    = vpk_ll_statfs;
+	m_lowlevelOperations.listxattr = vpk_ll_listxattr;
+	m_lowlevelOperations.getxattr  = vpk_ll_getxattr;
+}
+
+// what fuse_main() does, but with a low-level session
+int Vpk::Vpkfs::runLowlevel() {
+	char *mountpoint = 0;
+	int multithreaded = 0;
+	int foreground = 0;
+
+	if (fuse_parse_cmdline(m_args.args(), &mountpoint, &multithreaded, &foreground) != 0) {
+		return 1;
+	}
+
+	int code = 1;
+	struct fuse_chan *chan = fuse_mount(mountpoint, m_args.args());
+	if (chan) {
+		struct fuse_session *session = fuse_lowlevel_new(m_args.args(),
+			&m_lowlevelOperations, sizeof(m_lowlevelOperations), this);
+
+		if (session) {
+			if (fuse_set_signal_handlers(session) == 0) {
+				fuse_session_add_chan(session, chan);
+
+				if (fuse_daemonize(foreground) == 0) {
+					int err = multithreaded ?
+						fuse_session_loop_mt(session) :
+						fuse_session_loop(session);
+					code = err ? 1 : 0;
+				}
+
+				fuse_session_remove_chan(chan);
+				fuse_remove_signal_handlers(session);
+			}
+			fuse_session_destroy(session);
+		}
+		fuse_unmount(mountpoint, chan);
+	}
+	free(mountpoint);
+
+	return code;
+}
+
+void Vpk::Vpkfs::lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+	const Inode *dir = inode(parent);
+
+	if (!dir) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	if (dir->node->type() != Node::DIR) {
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	struct fuse_entry_param entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.attr_timeout  = CACHE_TIMEOUT;
+	entry.entry_timeout = CACHE_TIMEOUT;
+
+	// inode number 0 lets the kernel cache that the name doesn't exist
+	const Node *node = ((const Dir*) dir->node)->node(name);
+	if (node) {
+		int code = stat(node, &entry.attr);
+		if (code != 0) {
+			fuse_reply_err(req, -code);
+			return;
+		}
+		entry.ino = node->inode();
+	}
+
+	fuse_reply_entry(req, &entry);
+}
+
+void Vpk::Vpkfs::getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *) {
+	const Inode *node = inode(ino);
+
+	if (!node) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+
+	struct stat stbuf;
+	int code = stat(node->node, &stbuf);
+	if (code != 0) {
+		fuse_reply_err(req, -code);
+	}
+	else {
+		fuse_reply_attr(req, &stbuf, CACHE_TIMEOUT);
+	}
+}
+
+void Vpk::Vpkfs::opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	const Inode *node = inode(ino);
+
+	if (!node) {
+		fuse_reply_err(req, ENOENT);
+	}
+	else if (node->node->type() != Node::DIR) {
+		fuse_reply_err(req, ENOTDIR);
+	}
+	else if ((fi->flags & 3) != O_RDONLY) {
+		fuse_reply_err(req, EACCES);
+	}
+	else {
+		fuse_reply_open(req, fi);
+	}
+}
+
+// offset 0 is ".", 1 is ".." and 2 + n is the nth child
+void Vpk::Vpkfs::readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                         struct fuse_file_info *) {
+	const Inode *dir = inode(ino);
+
+	if (!dir || dir->node->type() != Node::DIR) {
+		fuse_reply_err(req, ENOTDIR);
+		return;
+	}
+
+	off_t count = ((const Dir*) dir->node)->nodes().size() + 2;
+	std::vector<char> buf(std::max(size, (size_t) 1));
+	size_t used = 0;
+
+	struct stat stbuf;
+	memset(&stbuf, 0, sizeof(struct stat));
+
+	for (off_t entry = std::max(off, (off_t) 0); entry < count; ++ entry) {
+		fuse_ino_t child;
+		const char *name;
+
+		if (entry == 0) {
+			child = ino;
+			name  = ".";
+		}
+		else if (entry == 1) {
+			child = dir->parent;
+			name  = "..";
+		}
+		else {
+			child = dir->children + (entry - 2);
+			name  = m_inodes[child].node->name().c_str();
+		}
+
+		// only the file type and inode number are used
+		stbuf.st_ino  = child;
+		stbuf.st_mode = m_inodes[child].node->type() == Node::DIR ? S_IFDIR : S_IFREG;
+
+		size_t length = fuse_add_direntry(req, &buf[0] + used, size - used, name, &stbuf, entry + 1);
+		if (length > size - used) break;
+		used += length;
+	}
+
+	fuse_reply_buf(req, &buf[0], used);
+}
+
+void Vpk::Vpkfs::open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+	const Inode *node = inode(ino);
+
+	int code = open(node ? node->node : 0, fi);
+	if (code != 0) {
+		fuse_reply_err(req, -code);
+	}
+	else {
+		fuse_reply_open(req, fi);
+	}
+}
+
+void Vpk::Vpkfs::read(fuse_req_t req, fuse_ino_t, size_t size, off_t off,
+                      struct fuse_file_info *fi) {
+#if FUSE_USE_VERSION >= 29
+	struct fuse_bufvec *bufvec = 0;
+	int count = read_buf((const char *) 0, &bufvec, size, off, fi);
+	if (count < 0) {
+		fuse_reply_err(req, -count);
+		return;
+	}
+
+	fuse_reply_data(req, bufvec, FUSE_BUF_SPLICE_MOVE);
+	vpk_free_bufvec(bufvec);
+#else
+	std::vector<char> buf(size ? size : 1);
+	int count = read((const char *) 0, &buf[0], size, off, fi);
+	if (count < 0) {
+		fuse_reply_err(req, -count);
+	}
+	else {
+		fuse_reply_buf(req, &buf[0], count);
+	}
+#endif
+}
+
+void Vpk::Vpkfs::statfs(fuse_req_t req, fuse_ino_t) {
+	struct statvfs stbuf;
+	int code = statfs((const char *) 0, &stbuf);
+	if (code != 0) {
+		fuse_reply_err(req, code < 0 ? -code : EIO);
+	}
+	else {
+		fuse_reply_statfs(req, &stbuf);
+	}
+}
+
+void Vpk::Vpkfs::listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
+	const Inode *node = inode(ino);
+	std::vector<char> buf(size);
+
+	int count = listxattr(node ? node->node : 0, size ? &buf[0] : 0, size);
+	vpk_reply_xattr(req, count, buf, size);
+}
+
+void Vpk::Vpkfs::getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size) {
+	const Inode *node = inode(ino);
+	std::vector<char> buf(size);
+
+	int count = getxattr(node ? node->node : 0, name, size ? &buf[0] : 0, size);
+	vpk_reply_xattr(req, count, buf, size);
+}